@@ -113,17 +113,24 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * Each request covers a range of pages in one address space, so a
+ * CPU gets at most one per shootdown however many pages it covers.
+ * Senders wait for their shootdowns to finish before sending more,
+ * so each CPU has at most one request from every other CPU queued;
+ * the queue is sized for the most CPUs the shootdown code handles
+ * (32, one bit each in ipi_tlbshootdown_cpus's mask).
  */
 
+struct vm_shootdown;	/* in vmtlb.c */
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct vm_shootdown *ts_sync;	/* for reporting completion */
+	uint32_t ts_asid;		/* address space ID, or 0 for all */
+	vaddr_t ts_start;		/* first page */
+	unsigned ts_npages;		/* number of pages */
 };
 
-#define TLBSHOOTDOWN_MAX 16
+#define TLBSHOOTDOWN_MAX 32
 
 
 #endif /* _MIPS_VM_H_ */
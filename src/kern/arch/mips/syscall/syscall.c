@@ -30,11 +30,15 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/syscall.h>
+#include <endian.h>
 #include <lib.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <copyinout.h>
+#include <addrspace.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -81,6 +85,13 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+	uint64_t offset;
+	uint32_t high;
+	int32_t whence;
+	off_t pos;
+#if !OPT_DUMBVM
+	int32_t fd;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -109,6 +120,99 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_fork:
+		err = sys_fork(tf, &retval);
+		break;
+
+	    case SYS_execv:
+		err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_waitpid:
+		err = sys_waitpid(tf->tf_a0, (userptr_t)tf->tf_a1,
+				  tf->tf_a2, &retval);
+		break;
+
+	    case SYS__exit:
+		sys__exit(tf->tf_a0);
+		/* NOTREACHED */
+
+	    case SYS_getpid:
+		err = sys_getpid(&retval);
+		break;
+
+	    case SYS_open:
+		err = sys_open((userptr_t)tf->tf_a0, tf->tf_a1,
+			       (mode_t)tf->tf_a2, &retval);
+		break;
+
+	    case SYS_read:
+		err = sys_read(tf->tf_a0, (userptr_t)tf->tf_a1,
+			       (size_t)tf->tf_a2, &retval);
+		break;
+
+	    case SYS_write:
+		err = sys_write(tf->tf_a0, (userptr_t)tf->tf_a1,
+				(size_t)tf->tf_a2, &retval);
+		break;
+
+	    case SYS_lseek:
+		/* 64-bit offset in a2/a3, whence on the stack */
+		join32to64(tf->tf_a2, tf->tf_a3, &offset);
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &whence,
+			     sizeof(whence));
+		if (err) {
+			break;
+		}
+		err = sys_lseek(tf->tf_a0, (off_t)offset, whence, &pos);
+		if (err) {
+			break;
+		}
+		/* 64-bit result in v0/v1 */
+		split64to32((uint64_t)pos, &high, &tf->tf_v1);
+		retval = high;
+		break;
+
+	    case SYS_close:
+		err = sys_close(tf->tf_a0);
+		break;
+
+	    case SYS_dup2:
+		err = sys_dup2(tf->tf_a0, tf->tf_a1, &retval);
+		break;
+
+#if !OPT_DUMBVM
+	    case SYS_mmap:
+		/* fd at sp+16, then the 64-bit offset aligned at sp+24 */
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &fd,
+			     sizeof(fd));
+		if (err) {
+			break;
+		}
+		err = copyin((const_userptr_t)(tf->tf_sp + 24), &offset,
+			     sizeof(offset));
+		if (err) {
+			break;
+		}
+		err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			       tf->tf_a2, tf->tf_a3, fd, (off_t)offset,
+			       &retval);
+		break;
+
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+	    case SYS_msync:
+		err = sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+				tf->tf_a2);
+		break;
+#endif
+
 	    /* Add stuff here */
 
 	    default:
@@ -149,13 +253,22 @@ syscall(struct trapframe *tf)
 /*
  * Enter user mode for a newly forked process.
  *
- * This function is provided as a reminder. You need to write
- * both it and the code that calls it.
- *
- * Thus, you can trash it and do things another way if you prefer.
+ * TF is a copy of the parent's trapframe from the fork system call,
+ * on the heap; it has to be on our own stack for mips_usermode, so
+ * copy it there and free it. Then return 0 from fork, in the child.
  */
 void
 enter_forked_process(struct trapframe *tf)
 {
-	(void)tf;
+	struct trapframe mytf;
+
+	mytf = *tf;
+	kfree(tf);
+
+	mytf.tf_v0 = 0;
+	mytf.tf_a3 = 0;		/* signal no error */
+	mytf.tf_epc += 4;	/* don't redo the syscall */
+
+	as_activate();
+	mips_usermode(&mytf);
 }
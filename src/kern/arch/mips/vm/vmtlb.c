@@ -0,0 +1,358 @@
+/*
+ * MIPS TLB handling for the VM system (see vm.h). dumbvm has its own.
+ *
+ * Replacement: after a flush, each CPU fills its TLB in slot order
+ * (curcpu->c_tlbfree counts the slots used so far), so the common
+ * case of refilling after a context switch never has to search for
+ * a free slot or evict anything. Once the TLB is full, the hardware's
+ * random slot is used; the MIPS has no reference bits, and random
+ * replacement does about as well as anything cheap without them.
+ *
+ * Address space IDs: each TLB entry is tagged with the 6-bit ASID of
+ * its address space, so switching address spaces only means loading
+ * a new ASID into entryhi, and a process's entries survive while
+ * others run. ASIDs are handed out in order within a generation
+ * (as_asid holds generation and ASID together); when they run out,
+ * the generation goes up and every address space has to get a new
+ * ASID the next time it's activated. A CPU flushes its TLB when it
+ * first uses an ASID of the new generation, so entries left from an
+ * older one can never match. ASID 0 is never handed out, and
+ * generation 0 never exists, so as_asid == 0 means "no ASID".
+ *
+ * ASIDs are not freed when an address space goes away, only on
+ * rollover: the dead address space's entries may still be in some
+ * TLB. Dropping all of a live address space's mappings is done the
+ * same way, by retiring its ASID (see vm_asid_islocal).
+ *
+ * Shootdowns: as_cpus records which CPUs have run an address space
+ * under its current ASID, and so which TLBs can hold its entries.
+ * vm_tlb_shootdown sends one request per CPU for a whole range of
+ * pages to just those CPUs, instead of one per page to everyone.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <proc.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+
+#define ASID_BITS	TLBHI_PIDSHIFT
+#define ASID_MAX	(TLBHI_PID >> TLBHI_PIDSHIFT)
+#define ASID_GEN(a)	((a) >> ASID_BITS)
+#define ASID_ID(a)	((a) & ASID_MAX)
+
+/* Ranges of fewer pages than this are probed for page by page. */
+#define VM_TLB_PROBEMAX	16
+
+/* Protects the ASID allocator and every as_asid and as_cpus. */
+static struct spinlock vm_asidlock = SPINLOCK_INITIALIZER;
+static uint32_t vm_asidgen = 1;		/* current generation */
+static uint32_t vm_asidnext = 1;	/* next unused ASID in it */
+
+void
+vm_tlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	uint32_t ehi, elo;
+	int index, spl;
+
+	ehi = (vaddr & TLBHI_VPAGE) | (curcpu->c_asid << TLBHI_PIDSHIFT);
+	elo = (paddr & TLBLO_PPAGE) | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	/* Never enter the same page twice; replace it if it's there. */
+	index = tlb_probe(ehi, 0);
+	if (index >= 0) {
+		tlb_write(ehi, elo, index);
+	}
+	else if (curcpu->c_tlbfree < NUM_TLB) {
+		tlb_write(ehi, elo, curcpu->c_tlbfree++);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+
+	splx(spl);
+}
+
+void
+vm_tlb_flush(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	curcpu->c_tlbfree = 0;
+	/* Writing the invalid entries clobbered the current ASID. */
+	tlb_setentryhi(curcpu->c_asid << TLBHI_PIDSHIFT);
+	splx(spl);
+}
+
+/*
+ * Give AS a new ASID, retiring whatever it had. Call with
+ * vm_asidlock held.
+ */
+static
+void
+vm_asid_alloc(struct addrspace *as)
+{
+	if (vm_asidnext > ASID_MAX) {
+		/* Out of ASIDs; start a new generation. */
+		vm_asidgen++;
+		vm_asidnext = 1;
+	}
+	as->as_asid = (vm_asidgen << ASID_BITS) | vm_asidnext++;
+	as->as_cpus = 0;
+}
+
+/*
+ * Start using AS's ASID on this CPU. Call with vm_asidlock held.
+ */
+static
+void
+vm_asid_load(struct addrspace *as)
+{
+	KASSERT(ASID_GEN(as->as_asid) == vm_asidgen);
+	KASSERT(curcpu->c_number < 32);
+
+	if (curcpu->c_asidgen != vm_asidgen) {
+		/* Our TLB may hold entries under recycled ASIDs. */
+		curcpu->c_asid = 0;
+		vm_tlb_flush();
+		curcpu->c_asidgen = vm_asidgen;
+	}
+	as->as_cpus |= (uint32_t)1 << curcpu->c_number;
+	curcpu->c_asid = ASID_ID(as->as_asid);
+	tlb_setentryhi(curcpu->c_asid << TLBHI_PIDSHIFT);
+}
+
+void
+vm_tlb_activate(struct addrspace *as)
+{
+	/* This also keeps interrupts off while entryhi changes. */
+	spinlock_acquire(&vm_asidlock);
+	if (ASID_GEN(as->as_asid) != vm_asidgen) {
+		vm_asid_alloc(as);
+	}
+	vm_asid_load(as);
+	spinlock_release(&vm_asidlock);
+}
+
+/*
+ * Check whether entries tagged with AS's ASID can only be in this
+ * CPU's TLB, so they can be invalidated here. If not, retire the
+ * ASID: other CPUs can keep their stale entries, since nothing will
+ * match them again. If AS is RUNNING here it gets a fresh ASID right
+ * away. Call with vm_asidlock held.
+ */
+static
+bool
+vm_asid_islocal(struct addrspace *as, bool running)
+{
+	uint32_t me;
+
+	me = (uint32_t)1 << curcpu->c_number;
+	if (ASID_GEN(as->as_asid) == vm_asidgen &&
+	    (as->as_cpus & ~me) == 0) {
+		return true;
+	}
+
+	as->as_asid = 0;
+	as->as_cpus = 0;
+	if (running) {
+		vm_asid_alloc(as);
+		vm_asid_load(as);
+	}
+	return false;
+}
+
+/*
+ * Drop this CPU's entries for pages START to END (exclusive) tagged
+ * with ASID, if it's of the generation our TLB holds. A few pages
+ * are cheaper to probe for; more than that, and it's cheaper to look
+ * at each entry instead. Call with interrupts off.
+ */
+static
+void
+vm_tlb_drop(uint32_t asid, vaddr_t start, vaddr_t end)
+{
+	uint32_t ehi, elo, pid;
+	vaddr_t va;
+	unsigned i;
+	int index;
+
+	if (ASID_GEN(asid) != curcpu->c_asidgen) {
+		/* Flushed since, or never loaded here. */
+		return;
+	}
+	pid = ASID_ID(asid) << TLBHI_PIDSHIFT;
+
+	if ((end - start) / PAGE_SIZE < VM_TLB_PROBEMAX) {
+		for (va = start; va < end; va += PAGE_SIZE) {
+			index = tlb_probe(va | pid, 0);
+			if (index >= 0) {
+				tlb_write(TLBHI_INVALID(index),
+					  TLBLO_INVALID(), index);
+			}
+		}
+	}
+	else {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_read(&ehi, &elo, i);
+			if ((elo & TLBLO_VALID) &&
+			    (ehi & TLBHI_PID) == pid &&
+			    (ehi & TLBHI_VPAGE) >= start &&
+			    (ehi & TLBHI_VPAGE) < end) {
+				tlb_write(TLBHI_INVALID(i),
+					  TLBLO_INVALID(), i);
+			}
+		}
+	}
+	tlb_setentryhi(curcpu->c_asid << TLBHI_PIDSHIFT);
+}
+
+void
+vm_tlb_invalidate_all(struct addrspace *as)
+{
+	bool running;
+
+	running = as == proc_getas();
+
+	spinlock_acquire(&vm_asidlock);
+	if (vm_asid_islocal(as, running) && as->as_cpus != 0) {
+		vm_tlb_drop(as->as_asid, 0, USERSPACETOP);
+	}
+	spinlock_release(&vm_asidlock);
+}
+
+/*
+ * Completion tracking for a shootdown: vs_pending counts the target
+ * CPUs that haven't flushed yet. It may briefly go negative, since
+ * targets can finish before the sender has counted them in.
+ */
+struct vm_shootdown {
+	struct spinlock vs_lock;
+	int vs_pending;
+};
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	if (ts->ts_asid == 0) {
+		vm_tlb_flush();
+	}
+	else {
+		vm_tlb_drop(ts->ts_asid, ts->ts_start,
+			    ts->ts_start + ts->ts_npages * PAGE_SIZE);
+	}
+
+	spinlock_acquire(&ts->ts_sync->vs_lock);
+	ts->ts_sync->vs_pending--;
+	spinlock_release(&ts->ts_sync->vs_lock);
+}
+
+/*
+ * Wait for the N CPUs a shootdown was sent to to finish it.
+ */
+static
+void
+vm_shootdown_wait(struct vm_shootdown *vs, unsigned n)
+{
+	bool done;
+
+	spinlock_acquire(&vs->vs_lock);
+	vs->vs_pending += n;
+	spinlock_release(&vs->vs_lock);
+
+	/*
+	 * Spin rather than sleep: the wait is short, and interrupts
+	 * stay on between checks so shootdowns sent to us still get
+	 * handled.
+	 */
+	do {
+		spinlock_acquire(&vs->vs_lock);
+		done = vs->vs_pending == 0;
+		spinlock_release(&vs->vs_lock);
+	} while (!done);
+}
+
+void
+vm_tlb_shootdown(struct addrspace *as, vaddr_t start, unsigned npages)
+{
+	struct vm_shootdown vs;
+	struct tlbshootdown ts;
+	uint32_t asid, cpus, me;
+	unsigned n;
+	int spl;
+
+	KASSERT((start & PAGE_FRAME) == start);
+
+	/*
+	 * Which CPUs may have loaded the pages under the current
+	 * ASID. A CPU that starts running AS after this loads the
+	 * new mappings, since the caller has already changed them.
+	 */
+	spinlock_acquire(&vm_asidlock);
+	asid = as->as_asid;
+	cpus = as->as_cpus;
+	spinlock_release(&vm_asidlock);
+
+	if (asid == 0 || npages == 0) {
+		/* Retired or never used; nothing can match. */
+		return;
+	}
+
+	me = (uint32_t)1 << curcpu->c_number;
+	if (cpus & me) {
+		spl = splhigh();
+		vm_tlb_drop(asid, start, start + npages * PAGE_SIZE);
+		splx(spl);
+	}
+	if ((cpus & ~me) == 0) {
+		return;
+	}
+
+	spinlock_init(&vs.vs_lock);
+	vs.vs_pending = 0;
+	ts.ts_sync = &vs;
+	ts.ts_asid = asid;
+	ts.ts_start = start;
+	ts.ts_npages = npages;
+
+	n = ipi_tlbshootdown_cpus(cpus, &ts);
+	vm_shootdown_wait(&vs, n);
+
+	spinlock_cleanup(&vs.vs_lock);
+}
+
+void
+vm_tlb_shootdown_all(void)
+{
+	struct vm_shootdown vs;
+	struct tlbshootdown ts;
+	unsigned n;
+
+	spinlock_init(&vs.vs_lock);
+	vs.vs_pending = 0;
+	ts.ts_sync = &vs;
+	ts.ts_asid = 0;
+	ts.ts_start = 0;
+	ts.ts_npages = 0;
+
+	vm_tlb_flush();
+	n = ipi_tlbshootdown_broadcast(&ts);
+	vm_shootdown_wait(&vs, n);
+
+	spinlock_cleanup(&vs.vs_lock);
+}
@@ -56,13 +56,18 @@ SRCS+=$(KTOP)/lib/uio.c
 SRCS+=$(KTOP)/main/main.c
 SRCS+=$(KTOP)/main/menu.c
 SRCS+=$(KTOP)/proc/proc.c
+SRCS+=$(KTOP)/syscall/execargs.c
+SRCS+=$(KTOP)/syscall/file_syscalls.c
 SRCS+=$(KTOP)/syscall/loadelf.c
+SRCS+=$(KTOP)/syscall/openfile.c
+SRCS+=$(KTOP)/syscall/proc_syscalls.c
 SRCS+=$(KTOP)/syscall/runprogram.c
 SRCS+=$(KTOP)/syscall/time_syscalls.c
 SRCS+=$(KTOP)/test/arraytest.c
 SRCS+=$(KTOP)/test/bitmaptest.c
 SRCS+=$(KTOP)/test/fstest.c
 SRCS+=$(KTOP)/test/kmalloctest.c
+SRCS+=$(KTOP)/test/proctest.c
 SRCS+=$(KTOP)/test/semunit.c
 SRCS+=$(KTOP)/test/synchtest.c
 SRCS+=$(KTOP)/test/threadlisttest.c
@@ -82,7 +87,10 @@ SRCS+=$(KTOP)/vfs/vfslist.c
 SRCS+=$(KTOP)/vfs/vfslookup.c
 SRCS+=$(KTOP)/vfs/vfspath.c
 SRCS+=$(KTOP)/vfs/vnode.c
+SRCS+=$(KTOP)/vm/coremap.c
 SRCS+=$(KTOP)/vm/kmalloc.c
+SRCS+=$(KTOP)/vm/kmem_cache.c
+SRCS+=$(KTOP)/vm/textcache.c
 SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/adddi3.c
 SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/anddi3.c
 SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashldi3.c
@@ -56,13 +56,19 @@ SRCS+=$(KTOP)/lib/uio.c
 SRCS+=$(KTOP)/main/main.c
 SRCS+=$(KTOP)/main/menu.c
 SRCS+=$(KTOP)/proc/proc.c
+SRCS+=$(KTOP)/syscall/execargs.c
+SRCS+=$(KTOP)/syscall/file_syscalls.c
 SRCS+=$(KTOP)/syscall/loadelf.c
+SRCS+=$(KTOP)/syscall/openfile.c
+SRCS+=$(KTOP)/syscall/proc_syscalls.c
 SRCS+=$(KTOP)/syscall/runprogram.c
 SRCS+=$(KTOP)/syscall/time_syscalls.c
+SRCS+=$(KTOP)/syscall/vm_syscalls.c
 SRCS+=$(KTOP)/test/arraytest.c
 SRCS+=$(KTOP)/test/bitmaptest.c
 SRCS+=$(KTOP)/test/fstest.c
 SRCS+=$(KTOP)/test/kmalloctest.c
+SRCS+=$(KTOP)/test/proctest.c
 SRCS+=$(KTOP)/test/semunit.c
 SRCS+=$(KTOP)/test/synchtest.c
 SRCS+=$(KTOP)/test/threadlisttest.c
@@ -83,7 +89,13 @@ SRCS+=$(KTOP)/vfs/vfslookup.c
 SRCS+=$(KTOP)/vfs/vfspath.c
 SRCS+=$(KTOP)/vfs/vnode.c
 SRCS+=$(KTOP)/vm/addrspace.c
+SRCS+=$(KTOP)/vm/coremap.c
 SRCS+=$(KTOP)/vm/kmalloc.c
+SRCS+=$(KTOP)/vm/kmem_cache.c
+SRCS+=$(KTOP)/vm/pagetable.c
+SRCS+=$(KTOP)/vm/swap.c
+SRCS+=$(KTOP)/vm/textcache.c
+SRCS+=$(KTOP)/vm/vm.c
 SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/adddi3.c
 SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/anddi3.c
 SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashldi3.c
@@ -112,6 +124,7 @@ SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switchframe.c
 SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/thread_machdep.c
 SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/threadstart.S
 SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/ram.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/vmtlb.c
 SRCS.MACHINE.mips+=$(KTOP)/vm/copyinout.c
 SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/cache-mips161.S
 SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/exception-mips1.S
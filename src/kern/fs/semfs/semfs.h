@@ -95,6 +95,9 @@ struct semfs {
 
 	struct lock *semfs_dirlock;		/* Lock for following */
 	struct semfs_direntryarray *semfs_dents; /* The root directory */
+
+	struct kmem_cache *semfs_semcache;	/* For struct semfs_sem */
+	struct kmem_cache *semfs_vnodecache;	/* For struct semfs_vnode */
 };
 
 /*
@@ -110,9 +113,11 @@ DEFARRAY(semfs_direntry, SEMFS_INLINE);
  */
 
 /* in semfs_obj.c */
-struct semfs_sem *semfs_sem_create(const char *name);
+int semfs_sem_ctor(void *);
+void semfs_sem_dtor(void *);
+struct semfs_sem *semfs_sem_create(struct semfs *);
 int semfs_sem_insert(struct semfs *, struct semfs_sem *, unsigned *);
-void semfs_sem_destroy(struct semfs_sem *);
+void semfs_sem_destroy(struct semfs *, struct semfs_sem *);
 struct semfs_direntry *semfs_direntry_create(const char *name, unsigned semno);
 void semfs_direntry_destroy(struct semfs_direntry *);
 
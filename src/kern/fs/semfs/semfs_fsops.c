@@ -33,6 +33,7 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <kmem_cache.h>
 
 #include "semfs.h"
 
@@ -100,7 +101,7 @@ semfs_destroy(struct semfs *semfs)
 	num = semfs_semarray_num(semfs->semfs_sems);
 	for (i=0; i<num; i++) {
 		sem = semfs_semarray_get(semfs->semfs_sems, i);
-		semfs_sem_destroy(sem);
+		semfs_sem_destroy(semfs, sem);
 	}
 	semfs_semarray_setsize(semfs->semfs_sems, 0);
 
@@ -116,6 +117,8 @@ semfs_destroy(struct semfs *semfs)
 	semfs_semarray_destroy(semfs->semfs_sems);
 	vnodearray_destroy(semfs->semfs_vnodes);
 	lock_destroy(semfs->semfs_tablelock);
+	kmem_cache_destroy(semfs->semfs_vnodecache);
+	kmem_cache_destroy(semfs->semfs_semcache);
 	kfree(semfs);
 }
 
@@ -165,9 +168,23 @@ semfs_create(void)
 		goto fail_total;
 	}
 
+	semfs->semfs_semcache = kmem_cache_create("semfs_sem",
+						  sizeof(struct semfs_sem),
+						  semfs_sem_ctor,
+						  semfs_sem_dtor);
+	if (semfs->semfs_semcache == NULL) {
+		goto fail_semfs;
+	}
+	semfs->semfs_vnodecache = kmem_cache_create("semfs_vnode",
+						    sizeof(struct semfs_vnode),
+						    NULL, NULL);
+	if (semfs->semfs_vnodecache == NULL) {
+		goto fail_semcache;
+	}
+
 	semfs->semfs_tablelock = lock_create("semfs_table");
 	if (semfs->semfs_tablelock == NULL) {
-		goto fail_semfs;
+		goto fail_vnodecache;
 	}
 	semfs->semfs_vnodes = vnodearray_create();
 	if (semfs->semfs_vnodes == NULL) {
@@ -199,6 +216,10 @@ semfs_create(void)
 	vnodearray_destroy(semfs->semfs_vnodes);
  fail_tablelock:
 	lock_destroy(semfs->semfs_tablelock);
+ fail_vnodecache:
+	kmem_cache_destroy(semfs->semfs_vnodecache);
+ fail_semcache:
+	kmem_cache_destroy(semfs->semfs_semcache);
  fail_semfs:
 	kfree(semfs);
  fail_total:
@@ -30,6 +30,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <synch.h>
+#include <kmem_cache.h>
 
 #define SEMFS_INLINE
 #include "semfs.h"
@@ -37,53 +38,63 @@
 ////////////////////////////////////////////////////////////
 // semfs_sem
 
+/*
+ * Object cache constructor and destructor for semfs_sem. The lock
+ * and CV live as long as the structure does, across any number of
+ * semaphores, so they get generic names rather than the semaphore's.
+ */
+int
+semfs_sem_ctor(void *obj)
+{
+	struct semfs_sem *sem = obj;
+
+	sem->sems_lock = lock_create("sem:lock");
+	if (sem->sems_lock == NULL) {
+		return ENOMEM;
+	}
+	sem->sems_cv = cv_create("sem");
+	if (sem->sems_cv == NULL) {
+		lock_destroy(sem->sems_lock);
+		return ENOMEM;
+	}
+	return 0;
+}
+
+void
+semfs_sem_dtor(void *obj)
+{
+	struct semfs_sem *sem = obj;
+
+	cv_destroy(sem->sems_cv);
+	lock_destroy(sem->sems_lock);
+}
+
 /*
  * Constructor for semfs_sem.
  */
 struct semfs_sem *
-semfs_sem_create(const char *name)
+semfs_sem_create(struct semfs *semfs)
 {
 	struct semfs_sem *sem;
-	char lockname[32];
-	char cvname[32];
 
-	snprintf(lockname, sizeof(lockname), "sem:l.%s", name);
-	snprintf(cvname, sizeof(cvname), "sem:%s", name);
-
-	sem = kmalloc(sizeof(*sem));
+	sem = kmem_cache_alloc(semfs->semfs_semcache);
 	if (sem == NULL) {
-		goto fail_return;
-	}
-	sem->sems_lock = lock_create(lockname);
-	if (sem->sems_lock == NULL) {
-		goto fail_sem;
-	}
-	sem->sems_cv = cv_create(cvname);
-	if (sem->sems_cv == NULL) {
-		goto fail_lock;
+		return NULL;
 	}
 	sem->sems_count = 0;
 	sem->sems_hasvnode = false;
 	sem->sems_linked = false;
 	return sem;
-
- fail_lock:
-	lock_destroy(sem->sems_lock);
- fail_sem:
-	kfree(sem);
- fail_return:
-	return NULL;
 }
 
 /*
  * Destructor for semfs_sem.
  */
 void
-semfs_sem_destroy(struct semfs_sem *sem)
+semfs_sem_destroy(struct semfs *semfs, struct semfs_sem *sem)
 {
-	cv_destroy(sem->sems_cv);
-	lock_destroy(sem->sems_lock);
-	kfree(sem);
+	KASSERT(!lock_do_i_hold(sem->sems_lock));
+	kmem_cache_free(semfs->semfs_semcache, sem);
 }
 
 /*
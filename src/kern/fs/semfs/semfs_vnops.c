@@ -38,6 +38,7 @@
 #include <current.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <kmem_cache.h>
 
 #include "semfs.h"
 
@@ -411,7 +412,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	}
 
 	/* create it */
-	sem = semfs_sem_create(name);
+	sem = semfs_sem_create(semfs);
 	if (sem == NULL) {
 		result = ENOMEM;
 		goto fail_unlock;
@@ -457,7 +458,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	semfs_semarray_set(semfs->semfs_sems, semnum, NULL);
 	lock_release(semfs->semfs_tablelock);
  fail_uncreate:
-	semfs_sem_destroy(sem);
+	semfs_sem_destroy(semfs, sem);
  fail_unlock:
 	lock_release(semfs->semfs_dirlock);
 	return result;
@@ -501,7 +502,7 @@ semfs_remove(struct vnode *dirvn, const char *name)
 						   dent->semd_semnum, NULL);
 				lock_release(semfs->semfs_tablelock);
 				lock_release(sem->sems_lock);
-				semfs_sem_destroy(sem);
+				semfs_sem_destroy(semfs, sem);
 			}
 			else {
 				lock_release(sem->sems_lock);
@@ -585,7 +586,7 @@ void
 semfs_vnode_destroy(struct semfs_vnode *semv)
 {
 	vnode_cleanup(&semv->semv_absvn);
-	kfree(semv);
+	kmem_cache_free(semv->semv_semfs->semfs_vnodecache, semv);
 }
 
 /*
@@ -633,7 +634,7 @@ semfs_reclaim(struct vnode *vn)
 		if (sem->sems_linked == false) {
 			semfs_semarray_set(semfs->semfs_sems,
 					   semv->semv_semnum, NULL);
-			semfs_sem_destroy(sem);
+			semfs_sem_destroy(semfs, sem);
 		}
 	}
 
@@ -729,7 +730,7 @@ semfs_vnode_create(struct semfs *semfs, unsigned semnum)
 		optable = &semfs_semops;
 	}
 
-	semv = kmalloc(sizeof(*semv));
+	semv = kmem_cache_alloc(semfs->semfs_vnodecache);
 	if (semv == NULL) {
 		return NULL;
 	}
@@ -41,6 +41,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <kmem_cache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -262,6 +263,7 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	kmem_cache_destroy(sfs->sfs_vnode_cache);
 	vnodearray_destroy(sfs->sfs_vnodes);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
@@ -355,6 +357,13 @@ sfs_fs_create(void)
 	if (sfs->sfs_vnodes == NULL) {
 		goto cleanup_object;
 	}
+	sfs->sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						 sizeof(struct sfs_vnode),
+						 sfs_vnode_ctor,
+						 sfs_vnode_dtor);
+	if (sfs->sfs_vnode_cache == NULL) {
+		goto cleanup_vnodes;
+	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
@@ -362,6 +371,8 @@ sfs_fs_create(void)
 
 	return sfs;
 
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
 cleanup_object:
 	kfree(sfs);
 fail:
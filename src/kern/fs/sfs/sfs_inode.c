@@ -36,10 +36,33 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <kmem_cache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
+/*
+ * Constructor and destructor for the vnode cache. Cached vnodes keep
+ * their spinlock; sfs_loadvnode and sfs_reclaim only set up and tear
+ * down the rest (see vnode_setup).
+ */
+int
+sfs_vnode_ctor(void *obj)
+{
+	struct sfs_vnode *sv = obj;
+
+	vnode_ctor(&sv->sv_absvn);
+	return 0;
+}
+
+void
+sfs_vnode_dtor(void *obj)
+{
+	struct sfs_vnode *sv = obj;
+
+	vnode_dtor(&sv->sv_absvn);
+}
+
 /*
  * Write an on-disk inode structure back out to disk.
  */
@@ -77,8 +100,9 @@ sfs_reclaim(struct vnode *v)
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. The big lock, which
+	 * sfs_loadvnode's callers hold too, keeps anyone from finding
+	 * it in the vnode table until it is gone from there.
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -131,12 +155,13 @@ sfs_reclaim(struct vnode *v)
 	}
 	vnodearray_remove(sfs->sfs_vnodes, ix);
 
-	vnode_cleanup(&sv->sv_absvn);
+	/* The spinlock stays set up in the cache; see sfs_vnode_ctor. */
+	vnode_teardown(&sv->sv_absvn);
 
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(sfs->sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -184,7 +209,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(sfs->sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -198,7 +223,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs->sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -233,9 +258,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	}
 
 	/* Call the common vnode initializer */
-	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
+	result = vnode_setup(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs->sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -245,8 +270,8 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Add it to our table */
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
 	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
+		vnode_teardown(&sv->sv_absvn);
+		kmem_cache_free(sfs->sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -232,14 +232,16 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(), to ask whether the file can be mapped. Regular
+ * files can: the VM system pages mappings in with VOP_READ and
+ * writes them back with VOP_WRITE, which both go through sfs_io.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 /*
@@ -63,6 +63,8 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		int *slot);
 
 /* Functions in sfs_inode.c */
+int sfs_vnode_ctor(void *obj);
+void sfs_vnode_dtor(void *obj);
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
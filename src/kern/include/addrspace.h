@@ -39,15 +39,49 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
+struct vm_object;
 
 
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
  *
- * You write this.
+ * Without dumbvm, an address space is a list of regions plus a page
+ * table. Pages are only given memory when first touched (see
+ * vm_fault): zero-filled, or read from the region's file if it has
+ * one.
  */
 
+#if !OPT_DUMBVM
+/*
+ * A region is a page-aligned range of user addresses with the same
+ * permissions and backing. If vr_vnode is set, the bytes from
+ * vr_filevaddr to vr_filevaddr + vr_filesize come from the file
+ * starting at vr_fileoffset; everything else in the region reads as
+ * zeros until written.
+ *
+ * Regions made by mmap have vr_mapped set, and can be unmapped. If
+ * vr_shared is set too, changes to the file's part of the region are
+ * written back to the file by msync, munmap, and exit; once the
+ * process forks, the region's pages are kept in vr_object, which the
+ * copies share (see vm.c).
+ */
+struct vm_region {
+	struct vm_region *vr_next;
+	vaddr_t vr_base;		/* first address, page-aligned */
+	size_t vr_npages;		/* length in pages */
+	bool vr_writeable;
+	bool vr_mapped;			/* made by mmap */
+	bool vr_shared;			/* MAP_SHARED: write back to file */
+	struct vnode *vr_vnode;		/* backing file, or NULL */
+	off_t vr_fileoffset;
+	vaddr_t vr_filevaddr;
+	size_t vr_filesize;
+	struct vm_object *vr_object;	/* pages shared by fork, or NULL */
+};
+#endif
+
 struct addrspace {
 #if OPT_DUMBVM
         vaddr_t as_vbase1;
@@ -58,7 +92,15 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct vm_region *as_regions;	/* defined regions */
+        struct pagetable *as_pt;	/* resident pages */
+        struct vm_region *as_heap;	/* heap, grown by sbrk */
+        vaddr_t as_heapend;		/* current break */
+        struct lock *as_lock;		/* protects the above */
+        vaddr_t as_faultnext;		/* page after last fault-around */
+        unsigned as_faultwin;		/* fault-around window, in pages */
+        uint32_t as_asid;		/* TLB tag (see vmtlb.c) */
+        uint32_t as_cpus;		/* CPUs whose TLB may hold it */
 #endif
 };
 
@@ -99,6 +141,29 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_backing - say that the region containing VADDR gets
+ *                FILESIZE bytes at VADDR from file V at OFFSET, read
+ *                in as the pages are touched. Not in dumbvm.
+ *
+ *    as_findregion - return the region containing VADDR, or NULL.
+ *                Call with as_lock held. Not in dumbvm.
+ *
+ *    as_sbrk   - move the end of the heap (which as_complete_load
+ *                puts after the highest loaded segment) by AMOUNT
+ *                bytes, handing back the old end. Pages only get
+ *                memory when touched. Not in dumbvm.
+ *
+ *    as_mmap   - map LEN bytes of file V from OFFSET, with PROT and
+ *                FLAGS as for mmap(2), at VADDR if MAP_FIXED and
+ *                wherever there's room otherwise; hands back the
+ *                address. Not in dumbvm.
+ *
+ *    as_munmap - unmap the pages from VADDR to VADDR+LEN, writing
+ *                back shared ones. Not in dumbvm.
+ *
+ *    as_msync  - write back the shared mapped pages from VADDR to
+ *                VADDR+LEN. Not in dumbvm.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +182,19 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if !OPT_DUMBVM
+int               as_define_backing(struct addrspace *as, vaddr_t vaddr,
+                                    struct vnode *v, off_t offset,
+                                    size_t filesize);
+struct vm_region *as_findregion(struct addrspace *as, vaddr_t vaddr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, vaddr_t vaddr, size_t len,
+                          int prot, int flags, struct vnode *v,
+                          off_t offset, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t vaddr, size_t len);
+#endif
 
 
 /*
@@ -0,0 +1,60 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+#include <pagetable.h>
+
+/*
+ * Physical page allocator.
+ *
+ * The coremap has one entry for every physical page of RAM. Pages the
+ * kernel took before the coremap existed (kernel image, early
+ * kmalloc, the coremap itself) are marked fixed and never handed out
+ * or freed; everything else is managed here.
+ *
+ * Functions:
+ *     coremap_bootstrap - set up the coremap. Called from vm_bootstrap.
+ *                         Before this, allocations are passed through
+ *                         to ram_stealmem and can never be freed.
+ *     coremap_alloc     - allocate NPAGES physically contiguous pages.
+ *                         Returns 0 if there isn't enough memory.
+ *     coremap_alloc_zeroed - allocate one page, filled with zeros.
+ *                         Usually this comes from a pool zeroed
+ *                         ahead of time.
+ *     coremap_zeroidle  - add a page to the zeroed pool if it needs
+ *                         one; returns true if it did. For idle CPUs.
+ *     coremap_free      - drop a reference to a block of pages from
+ *                         coremap_alloc, given the address of its
+ *                         first page; the block is freed when the
+ *                         last reference goes. coremap_alloc hands
+ *                         out one reference.
+ *     coremap_incref    - add a reference to a block, for sharing it.
+ *     coremap_getref    - get a block's reference count.
+ *     coremap_nfreepages - get the number of pages that can be
+ *                         allocated without evicting anything.
+ *     coremap_setpte    - mark a user page as pageable, given its PTE.
+ *     coremap_touch     - note that a pageable page was used.
+ *     coremap_clock     - pick a pageable page to evict.
+ *     coremap_settag    - set the owner's tag byte on an allocated page.
+ *     coremap_gettag    - get it back; 0 if never set.
+ *     coremap_printstats - print page counts.
+ *
+ * alloc_kpages and free_kpages (see vm.h) are built on these.
+ */
+
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages);
+paddr_t coremap_alloc_zeroed(void);
+bool coremap_zeroidle(void);
+void coremap_free(paddr_t paddr);
+void coremap_incref(paddr_t paddr);
+unsigned coremap_getref(paddr_t paddr);
+unsigned long coremap_nfreepages(void);
+void coremap_setpte(paddr_t paddr, pte_t *pte);
+void coremap_touch(paddr_t paddr);
+paddr_t coremap_clock(pte_t **pteret);
+void coremap_settag(paddr_t paddr, unsigned tag);
+unsigned coremap_gettag(paddr_t paddr);
+void coremap_printstats(void);
+
+
+#endif /* _COREMAP_H_ */
@@ -61,6 +61,9 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned c_tlbfree;		/* VM: TLB slots from here are unused */
+	uint32_t c_asidgen;		/* VM: ASID generation of our TLB */
+	uint32_t c_asid;		/* VM: ASID currently in use */
 
 	/*
 	 * Accessed by other cpus.
@@ -155,6 +158,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast is ipi_tlbshootdown to all CPUs except
+ * the current one, and returns how many that was.
+ * ipi_tlbshootdown_cpus is the same, but only to the CPUs whose bit
+ * (1 << c_number) is set in CPUS.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +176,9 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_cpus(uint32_t cpus,
+			       const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
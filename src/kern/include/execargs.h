@@ -0,0 +1,42 @@
+#ifndef _EXECARGS_H_
+#define _EXECARGS_H_
+
+/*
+ * Argument vectors for a program being started (execv, runprogram).
+ *
+ * The arguments are kept in a single buffer laid out exactly as they
+ * will appear on the new program's user stack: the argv array
+ * (argc + 1 pointers, the last NULL) followed by the strings, packed.
+ * Until execargs_copyout, the array holds the strings' offsets in the
+ * buffer; copyout turns them into user addresses and writes the whole
+ * block with one copyout.
+ *
+ * Functions:
+ *     execargs_copyin  - collect the arguments from the user argv
+ *                        array ARGV in the current address space.
+ *                        The array and the strings are read in
+ *                        page-sized blocks rather than one pointer or
+ *                        string at a time. Fails with E2BIG if they
+ *                        don't fit in ARG_MAX.
+ *     execargs_kernel  - collect the NARGS kernel strings ARGS.
+ *     execargs_copyout - put the arguments on the stack below
+ *                        *STACKPTR in the current address space,
+ *                        updating *STACKPTR and returning the user
+ *                        address of the argv array in *ARGV.
+ *     execargs_cleanup - free the buffer.
+ */
+
+struct execargs {
+	char *ea_buf;		/* argv array, then the strings */
+	size_t ea_len;		/* bytes of ea_buf in use */
+	int ea_argc;
+};
+
+int execargs_copyin(struct execargs *ea, userptr_t argv);
+int execargs_kernel(struct execargs *ea, char **args, unsigned long nargs);
+int execargs_copyout(struct execargs *ea, vaddr_t *stackptr,
+		     userptr_t *argv);
+void execargs_cleanup(struct execargs *ea);
+
+
+#endif /* _EXECARGS_H_ */
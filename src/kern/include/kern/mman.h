@@ -0,0 +1,25 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap(), munmap(), and msync().
+ */
+
+/* Protection (mmap prot argument) */
+#define PROT_NONE	0x0	/* no access */
+#define PROT_READ	0x1	/* pages can be read */
+#define PROT_WRITE	0x2	/* pages can be written */
+#define PROT_EXEC	0x4	/* pages can be executed */
+
+/* Flags (mmap flags argument); one of MAP_SHARED or MAP_PRIVATE */
+#define MAP_SHARED	0x01	/* writes go to the file */
+#define MAP_PRIVATE	0x02	/* writes stay in this process */
+#define MAP_FIXED	0x10	/* map exactly at the address given */
+
+/* Flags for msync() */
+#define MS_ASYNC	0x1	/* write back, don't wait (same as MS_SYNC) */
+#define MS_SYNC		0x2	/* write back and wait */
+#define MS_INVALIDATE	0x4	/* (ignored) */
+
+
+#endif /* _KERN_MMAN_H_ */
@@ -59,6 +59,7 @@
 #define SYS_mmap         8
 #define SYS_munmap       9
 #define SYS_mprotect     10
+#define SYS_msync        121
 //#define SYS_madvise    11
 //#define SYS_mincore    12
 //#define SYS_mlock      13
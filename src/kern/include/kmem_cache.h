@@ -0,0 +1,46 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A kmem_cache hands out objects of one fixed size and keeps freed
+ * ones around for reuse, already constructed. The constructor runs
+ * once when an object is first made and the destructor once when it
+ * finally goes back to kmalloc, not on every allocate/free; in
+ * between, the owner must return objects to the cache in the state
+ * the constructor left them (e.g. locks created and not held, list
+ * nodes unlinked).
+ *
+ * Functions:
+ *     kmem_cache_create  - make a cache for objects of OBJSIZE bytes.
+ *                          CTOR returns 0 or an error code and may be
+ *                          NULL, as may DTOR. Returns NULL if out of
+ *                          memory.
+ *     kmem_cache_destroy - free all cached objects (running DTOR on
+ *                          each) and the cache. Objects still out
+ *                          must not be freed to it afterwards.
+ *     kmem_cache_alloc   - get an object; NULL if out of memory or if
+ *                          the constructor failed.
+ *     kmem_cache_free    - give an object back.
+ *     kmem_cache_reclaim - free the cached objects of every cache, for
+ *                          when memory runs out (see vm_reclaimpage).
+ *                          Returns false if there were none.
+ *
+ * kmem_cache_alloc allocates with kmalloc, which can sleep when
+ * memory is short while it gets pages reclaimed; otherwise these
+ * only sleep if the constructor or destructor does.
+ */
+
+struct kmem_cache;
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t objsize,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+bool kmem_cache_reclaim(void);
+
+
+#endif /* _KMEM_CACHE_H_ */
@@ -0,0 +1,93 @@
+#ifndef _OPENFILE_H_
+#define _OPENFILE_H_
+
+/*
+ * Open files and file descriptor tables.
+ *
+ * An openfile is what a file descriptor refers to: an open vnode
+ * together with the access mode it was opened with and the seek
+ * position. Several descriptors can share one openfile, in the same
+ * process (dup2) or in different ones (fork), so it is refcounted;
+ * the vnode is closed when the last reference goes away.
+ *
+ * Each openfile has its own sleep lock for the seek position, held
+ * across a read or write so that the position advances atomically.
+ * Nothing global is taken during I/O, so transfers on different open
+ * files proceed in parallel. Objects that can't seek (the console)
+ * have no position and don't take the lock at all.
+ *
+ * A filetable maps a process's descriptors to openfiles. Its
+ * spinlock is only held to look up or change a slot; callers get
+ * their own reference to the openfile and drop it when done.
+ */
+
+#include <limits.h>
+#include <spinlock.h>
+
+struct lock;
+struct vnode;
+
+struct openfile {
+	struct vnode *of_vnode;		/* the open object */
+	int of_accmode;			/* O_RDONLY, O_WRONLY, or O_RDWR */
+	bool of_append;			/* O_APPEND: writes go at EOF */
+	bool of_seekable;		/* has a position */
+
+	struct lock *of_lock;		/* protects of_offset */
+	off_t of_offset;		/* seek position */
+
+	struct spinlock of_reflock;	/* protects of_refcount */
+	unsigned of_refcount;
+};
+
+struct filetable {
+	struct spinlock ft_lock;	/* protects ft_files */
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+/*
+ * Functions:
+ *     openfile_bootstrap - set up. Called once during boot.
+ *     openfile_open   - open PATH with FLAGS and MODE as for open(2),
+ *                       returning a new openfile with one reference.
+ *                       May destroy PATH.
+ *     openfile_incref - add a reference.
+ *     openfile_decref - drop a reference; the last one closes the file.
+ *
+ *     filetable_create  - make an empty table. Returns NULL if out of
+ *                         memory.
+ *     filetable_copy    - make a copy of a table, sharing its openfiles
+ *                         (for fork).
+ *     filetable_destroy - drop all of a table's openfiles and free it.
+ *     filetable_stdio   - open the console as descriptors 0, 1, and 2.
+ *     filetable_get     - look up descriptor FD and return its openfile
+ *                         with a reference added for the caller.
+ *     filetable_place   - put OF in the lowest free descriptor. Takes
+ *                         over the caller's reference.
+ *     filetable_set     - put OF in descriptor FD, returning what was
+ *                         there (or NULL). Adds a reference to OF; the
+ *                         caller owns the returned one.
+ *     filetable_remove  - clear descriptor FD, returning the caller
+ *                         the reference it held.
+ *
+ * The table functions fail with EBADF for a descriptor that is out
+ * of range or (except for filetable_set) not open.
+ */
+
+void openfile_bootstrap(void);
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+struct filetable *filetable_create(void);
+int filetable_copy(struct filetable *ft, struct filetable **ret);
+void filetable_destroy(struct filetable *ft);
+int filetable_stdio(struct filetable *ft);
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_place(struct filetable *ft, struct openfile *of, int *fd);
+int filetable_set(struct filetable *ft, int fd, struct openfile *of,
+		  struct openfile **oldret);
+int filetable_remove(struct filetable *ft, int fd, struct openfile **ret);
+
+
+#endif /* _OPENFILE_H_ */
@@ -0,0 +1,81 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Page tables.
+ *
+ * Each address space has a two-level page table: the top ten bits of
+ * a user address index the directory, and the next ten pick a PTE
+ * out of a one-page table of 1024 entries. Second-level tables are
+ * only allocated for the 4M chunks of the address space that are
+ * actually touched.
+ *
+ * A PTE holds the physical page of a resident page plus flag bits.
+ * A PTE of 0 means the page has never been touched. PTE_COW marks a
+ * frame that may be shared with other address spaces (see as_copy);
+ * it must be copied, or found to be no longer shared, before the
+ * page can be written. A page that has been evicted has PTE_SWAPPED
+ * set and its swap slot in place of the frame number. PTE_CLEAN marks
+ * a page of a shared file mapping that hasn't been written since it
+ * was read or written back; it is mapped read-only to catch the
+ * first write.
+ *
+ * Functions:
+ *     pt_create  - make an empty page table. NULL if out of memory.
+ *     pt_destroy - free the page table. Frames the PTEs point at
+ *                  belong to the caller and must be freed first.
+ *     pt_lookup  - find the PTE for VADDR. If its second-level table
+ *                  doesn't exist, creates it if CREATE is true and
+ *                  otherwise returns NULL. Also NULL if out of memory.
+ *
+ * Page tables have no lock of their own; the address space's lock
+ * covers them.
+ */
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME	0xfffff000	/* physical page, if PTE_VALID */
+#define PTE_VALID	0x00000001	/* page is resident */
+#define PTE_COW		0x00000002	/* frame is shared; copy on write */
+#define PTE_SWAPPED	0x00000004	/* page is in swap; slot in top bits */
+#define PTE_BUSY	0x00000008	/* page is being evicted */
+#define PTE_WRITE	0x00000010	/* page is in a writeable region */
+#define PTE_CLEAN	0x00000020	/* same as the file; see above */
+
+#define PTE_SLOT(pte)		((pte) >> 12)
+#define PTE_MKSLOT(slot)	((pte_t)(slot) << 12)
+
+struct pagetable;
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+
+/*
+ * Page operations for the address space code, in vm.c.
+ *
+ *     vm_freepage - release the frame or swap slot in a PTE.
+ *     vm_copypage - copy a PTE for as_copy, sharing the page with
+ *                   copy-on-write if COW is set.
+ *     vm_shareregion - share shared mapped region VR of OLD with its
+ *                   copy NEWVR in NEWAS, for as_copy.
+ *     vm_object_incref - add a region to those using a page object.
+ *     vm_object_decref - drop a region's use of a page object.
+ *     vm_writeback - write the page at VADDR in shared mapped region
+ *                   VR of AS back to its file, if it has changed.
+ */
+struct addrspace;
+struct vm_region;
+struct vm_object;
+
+void vm_freepage(pte_t *pte);
+int vm_copypage(pte_t *oldpte, pte_t *newpte, bool cow);
+int vm_shareregion(struct addrspace *old, struct vm_region *vr,
+		   struct addrspace *newas, struct vm_region *newvr);
+void vm_object_incref(struct vm_object *obj);
+void vm_object_decref(struct vm_object *obj);
+int vm_writeback(struct addrspace *as, struct vm_region *vr,
+		 vaddr_t vaddr, pte_t *pte);
+
+
+#endif /* _PAGETABLE_H_ */
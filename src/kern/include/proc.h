@@ -36,9 +36,12 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <cdefs.h> /* for __DEAD */
 #include <spinlock.h>
 
 struct addrspace;
+struct cv;
+struct filetable;
 struct thread;
 struct vnode;
 
@@ -66,9 +69,25 @@ struct proc {
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	unsigned p_tlbmisses;		/* calls to vm_fault */
+	unsigned p_pagefaults;		/* ...that needed more than a refill */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
+	struct filetable *p_filetable;	/* open file descriptors */
+
+	/*
+	 * Process management. These are protected by the global PID
+	 * lock in proc.c, except that p_pid never changes once set.
+	 */
+	pid_t p_pid;			/* process id; 0 for kproc */
+	struct proc *p_parent;		/* NULL once orphaned */
+	struct proc *p_children;	/* first child */
+	struct proc *p_nextsib;		/* parent's other children */
+	struct proc *p_prevsib;
+	bool p_exited;			/* now a zombie */
+	int p_exitstatus;		/* encoded as for waitpid */
+	struct cv *p_waitcv;		/* signaled on exit */
 
 	/* add more material here as needed */
 };
@@ -85,6 +104,22 @@ struct proc *proc_create_runprogram(const char *name);
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/* Make a copy of the current process, for fork(). */
+int proc_fork(struct proc **ret);
+
+/* Discard a child made by proc_fork that never ran. */
+void proc_unfork(struct proc *proc);
+
+/* Exit the current process with STATUS (encoded as for waitpid). */
+__DEAD void proc_exit(int status);
+
+/*
+ * Wait for child PID of the current process to exit, then reap it
+ * with proc_reap once done with its exit status.
+ */
+int proc_wait(pid_t pid, int options, int *status, pid_t *ret);
+void proc_reap(pid_t pid);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -0,0 +1,39 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Pages evicted from memory are written to a raw disk, one page per
+ * slot, with a bitmap tracking which slots are in use. A slot's
+ * contents never change once written, so fork can share a slot
+ * between parent and child (see vm_copypage); each slot has a
+ * reference count, and whoever reads it back gets a copy of their
+ * own.
+ *
+ * Functions:
+ *     swap_bootstrap - attach SWAP_DEVICE as swap space. If it doesn't
+ *                      exist, the system runs without swap and
+ *                      swap_alloc always fails.
+ *     swap_alloc     - reserve a slot, with one reference. ENOSPC if
+ *                      there are none.
+ *     swap_incref    - add a reference to a slot.
+ *     swap_free      - drop a reference to a slot; it is released
+ *                      when the last one goes.
+ *     swap_out       - write the page at PADDR to SLOT.
+ *     swap_in        - read SLOT into the page at PADDR.
+ *
+ * swap_out and swap_in sleep.
+ */
+
+#define SWAP_DEVICE	"lhd1"
+
+void swap_bootstrap(void);
+int swap_alloc(unsigned *slot);
+void swap_incref(unsigned slot);
+void swap_free(unsigned slot);
+int swap_out(paddr_t paddr, unsigned slot);
+int swap_in(paddr_t paddr, unsigned slot);
+
+
+#endif /* _SWAP_H_ */
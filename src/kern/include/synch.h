@@ -75,8 +75,22 @@ void V(struct semaphore *);
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct wchan *lk_wchan;
+	struct spinlock lk_spinlock;
+	struct thread *volatile lk_holder;
+
+	/*
+	 * Contention statistics, protected by lk_spinlock. Dumped by
+	 * lock_printstats().
+	 */
+	unsigned lk_acquires;		/* Total lock_acquire calls */
+	unsigned lk_contended;		/* ...that found the lock held */
+	unsigned lk_spinwins;		/* ...and got it while spinning */
+	unsigned lk_sleeps;		/* Number of times we slept */
+
+	/* Link on the list of all locks, protected in synch.c. */
+	struct lock *lk_allnext;
+	struct lock *lk_allprev;
 };
 
 struct lock *lock_create(const char *name);
@@ -91,11 +105,17 @@ void lock_destroy(struct lock *);
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
- * These operations must be atomic. You get to write them.
+ * lock_acquire is adaptive: if the holder is currently running on
+ * another CPU, it spins for a bounded time first, since the lock will
+ * probably be released sooner than a context switch would take. Only
+ * then (or straight away if the holder is not running) does it sleep.
+ *
+ *    lock_printstats - Print the contention counters of all locks.
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
+void lock_printstats(void);
 
 
 /*
@@ -114,8 +134,8 @@ bool lock_do_i_hold(struct lock *);
 
 struct cv {
         char *cv_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct wchan *cv_wchan;
+	struct spinlock cv_lock;
 };
 
 struct cv *cv_create(const char *name);
@@ -132,11 +152,61 @@ void cv_destroy(struct cv *);
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
- * These operations must be atomic. You get to write them.
+ * These operations must be atomic.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or a single
+ * writer. Writers are preferred: once a writer is waiting, new
+ * readers block until it has had its turn, so a steady stream of
+ * readers cannot starve writers out.
+ *
+ * The deadlock detector (HANGMAN) only tracks the write side, since
+ * it models locks with a single holder.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+
+struct rwlock {
+        char *rwlock_name;
+        HANGMAN_LOCKABLE(rwlock_hangman);   /* Deadlock detector hook. */
+	struct spinlock rwlock_lock;
+	struct wchan *rwlock_readwchan;		/* Readers wait here */
+	struct wchan *rwlock_writewchan;	/* Writers wait here */
+	volatile unsigned rwlock_readers;	/* Number of active readers */
+	volatile unsigned rwlock_waitingwriters; /* Writers waiting */
+	struct thread *volatile rwlock_writer;	/* Active writer or NULL */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Multiple threads
+ *                          can hold the lock for reading at once.
+ *    rwlock_release_read  - Release a read hold.
+ *    rwlock_acquire_write - Get the lock for writing. Only one thread
+ *                          can hold the lock for writing, and then no
+ *                          thread holds it for reading.
+ *    rwlock_release_write - Release the write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                          the lock for writing.
+ *
+ * These operations must be atomic.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -58,5 +58,21 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_fork(struct trapframe *tf, int *retval);
+int sys_execv(userptr_t program, userptr_t args);
+int sys_waitpid(pid_t pid, userptr_t status, int options, int *retval);
+__DEAD void sys__exit(int code);
+int sys_getpid(int *retval);
+int sys_open(userptr_t path, int flags, mode_t mode, int *retval);
+int sys_read(int fd, userptr_t buf, size_t len, int *retval);
+int sys_write(int fd, userptr_t buf, size_t len, int *retval);
+int sys_lseek(int fd, off_t offset, int whence, off_t *retval);
+int sys_close(int fd);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_sbrk(intptr_t amount, int32_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
 
 #endif /* _SYSCALL_H_ */
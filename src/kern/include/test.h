@@ -54,6 +54,7 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int rwtest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -88,6 +89,9 @@ int longstress(int, char **);
 int createstress(int, char **);
 int printfile(int, char **);
 
+/* process tests */
+int pidtest(int, char **);
+
 /* other tests */
 int kmalloctest(int, char **);
 int kmallocstress(int, char **);
@@ -96,7 +100,7 @@ int kmalloctest4(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
-int runprogram(char *progname);
+int runprogram(char *progname, char **args, unsigned long nargs);
 
 /* Kernel menu system. */
 void menu(char *argstr);
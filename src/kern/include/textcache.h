@@ -0,0 +1,50 @@
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*
+ * Cache of read-only program pages, shared between address spaces.
+ *
+ * Pages of a program's read-only segments (text and read-only data)
+ * are the same in every process running it, so the first process to
+ * fault one in puts the frame here, and the others map the same
+ * frame instead of reading their own copy. The cache holds a
+ * reference to each frame (see coremap_incref), so a page stays
+ * resident after the last process using it exits, and the next exec
+ * of the program finds it without I/O.
+ *
+ * Pages are keyed on the vnode, its version (see vnode.h), and the
+ * file offset the page starts at. Only pages that come entirely from
+ * the file are cached; a partial page at either end of a segment is
+ * private to each process, as before.
+ *
+ * Cached frames are never paged out. When memory runs short (for
+ * user or kernel memory), frames that no process maps any more can be
+ * dropped. A vnode's entries are dropped as soon as its contents
+ * change or it is reclaimed (see vnode_changed and vnode_cleanup).
+ *
+ * Functions:
+ *     textcache_lookup  - return the cached frame for page OFFSET of
+ *                         V, with a new reference for the caller, or
+ *                         0 if it isn't cached.
+ *     textcache_insert  - offer frame *PA, holding page OFFSET of V as
+ *                         of VERSION (V's version from before the page
+ *                         was read). Returns true if the page is now
+ *                         cached, and sets *PA to the cached frame
+ *                         (dropping the caller's frame if someone got
+ *                         there first); either way the caller keeps
+ *                         one reference to *PA.
+ *     textcache_reclaim - free one frame nobody but the cache uses.
+ *                         Returns false if there isn't one.
+ *     textcache_purge   - drop all of V's entries.
+ */
+
+struct vnode;
+
+paddr_t textcache_lookup(struct vnode *v, off_t offset);
+bool textcache_insert(struct vnode *v, unsigned version, off_t offset,
+		      paddr_t *pa);
+bool textcache_reclaim(void);
+void textcache_purge(struct vnode *v);
+
+
+#endif /* _TEXTCACHE_H_ */
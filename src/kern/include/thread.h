@@ -85,6 +85,13 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields. Changed only by the thread itself, or
+	 * under the runqueue lock of its cpu while it is not running.
+	 */
+	unsigned t_priority;		/* MLFQ level; 0 is highest */
+	unsigned t_quantum_used;	/* hardclocks used at this level */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -159,15 +166,15 @@ __DEAD void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Charge the current thread for a hardclock's worth of cpu time, and
+ * say whether it should yield. Called from the timer interrupt.
  */
-void schedule(void);
+bool thread_tick(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Adjust priorities periodically. Called from the timer interrupt.
  */
-void thread_consider_migration(void);
+void schedule(void);
 
 
 #endif /* _THREAD_H_ */
@@ -77,6 +77,9 @@ void threadlist_cleanup(struct threadlist *tl);
 /* Check if it's empty */
 bool threadlist_isempty(struct threadlist *tl);
 
+/* Look at the first thread without removing it; NULL if empty */
+struct thread *threadlist_peekhead(struct threadlist *tl);
+
 /* Add and remove: at ends */
 void threadlist_addhead(struct threadlist *tl, struct thread *t);
 void threadlist_addtail(struct threadlist *tl, struct thread *t);
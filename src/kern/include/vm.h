@@ -39,6 +39,8 @@
 
 #include <machine/vm.h>
 
+struct addrspace;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -55,8 +57,41 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Free some memory (a frame in use for user memory, or the kernel's
+ * cached objects), so that an allocation that found memory full can
+ * try again. Returns false if nothing can be freed. May sleep.
+ */
+bool vm_reclaimpage(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Machine-dependent TLB handling for the VM system (not dumbvm).
+ *
+ *     vm_tlb_load  - map VADDR to PADDR in this CPU's TLB, allowing
+ *                    writes if WRITEABLE, replacing any existing
+ *                    mapping for VADDR.
+ *     vm_tlb_flush - drop every mapping in this CPU's TLB.
+ *     vm_tlb_shootdown_all - drop every mapping in every CPU's TLB,
+ *                    waiting until the other CPUs have done so.
+ *     vm_tlb_activate - make AS's mappings the ones this CPU's TLB
+ *                    matches, giving AS an address space ID if needed.
+ *     vm_tlb_shootdown - drop AS's mappings of the NPAGES pages from
+ *                    START from every TLB, waiting until the other
+ *                    CPUs have done so. Only CPUs that have run AS
+ *                    are asked. Call after changing the PTEs.
+ *     vm_tlb_invalidate_all - drop all of AS's mappings from every
+ *                    TLB. Must be called by AS's own thread, or
+ *                    while AS is not in use.
+ */
+void vm_tlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable);
+void vm_tlb_flush(void);
+void vm_tlb_shootdown_all(void);
+void vm_tlb_activate(struct addrspace *as);
+void vm_tlb_shootdown(struct addrspace *as, vaddr_t start, unsigned npages);
+void vm_tlb_invalidate_all(struct addrspace *as);
+
 
 #endif /* _VM_H_ */
@@ -34,6 +34,10 @@
 struct uio;
 struct stat;
 
+#ifndef VNODEINLINE
+#define VNODEINLINE INLINE
+#endif
+
 
 /*
  * A struct vnode is an abstract representation of a file.
@@ -47,10 +51,22 @@ struct stat;
  * Abstract low-level file.
  *
  * Note: vn_fs may be null if the vnode refers to a device.
+ *
+ * vn_version changes whenever the file's contents may have changed
+ * (after each VOP_WRITE and VOP_TRUNCATE on a file; devices, which
+ * vn_fs is null for, are never cached and keep theirs); it is bumped
+ * under vn_countlock. A new vnode starts from a global counter that is
+ * kept ahead of every version a reclaimed vnode reached, so a vnode
+ * and version together identify one state of a file, even after the
+ * vnode is reclaimed and the memory reused for another. Caches of
+ * file contents use it in place of a modification time, which not
+ * every filesystem keeps.
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
 	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	unsigned vn_version;            /* Contents version; see above */
+	bool vn_textcached;             /* May have pages in textcache.h */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -120,9 +136,10 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Check whether the file can be mapped into
+ *                      memory with mmap. The VM system does the
+ *                      mapping itself, using vop_read and vop_write
+ *                      to page the file in and write it back.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -231,14 +248,14 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              vop_write(vn, uio)
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           vop_truncate(vn, pos)
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -257,6 +274,47 @@ struct vnode_ops {
  */
 void vnode_check(struct vnode *, const char *op);
 
+/*
+ * Give the vnode a new version after its contents may have changed
+ * (see vnode_changed).
+ */
+void vnode_newversion(struct vnode *);
+
+VNODEINLINE int vnode_changed(struct vnode *vn, int result);
+VNODEINLINE int vop_write(struct vnode *vn, struct uio *uio);
+VNODEINLINE int vop_truncate(struct vnode *vn, off_t pos);
+
+/*
+ * Note a write or truncate of VN, and pass RESULT through. Even a
+ * failed one may have changed part of the file. Devices (the
+ * console, say) have nothing cached, so writing them costs nothing
+ * extra.
+ */
+VNODEINLINE int
+vnode_changed(struct vnode *vn, int result)
+{
+	if (vn->vn_fs != NULL) {
+		vnode_newversion(vn);
+	}
+	return result;
+}
+
+/*
+ * VOP_WRITE and VOP_TRUNCATE, as functions so VN is only evaluated
+ * once.
+ */
+VNODEINLINE int
+vop_write(struct vnode *vn, struct uio *uio)
+{
+	return vnode_changed(vn, __VOP(vn, write)(vn, uio));
+}
+
+VNODEINLINE int
+vop_truncate(struct vnode *vn, off_t pos)
+{
+	return vnode_changed(vn, __VOP(vn, truncate)(vn, pos));
+}
+
 /*
  * Reference count manipulation (handled above filesystem level)
  */
@@ -279,6 +337,20 @@ int vnode_init(struct vnode *, const struct vnode_ops *ops,
  */
 void vnode_cleanup(struct vnode *);
 
+/*
+ * The same split in two, for filesystems that keep their vnodes in
+ * an object cache (see kmem_cache.h): vnode_ctor and vnode_dtor set
+ * up and tear down the parts that survive in the cache (the
+ * spinlock), for the cache's constructor and destructor, and
+ * vnode_setup and vnode_teardown do the rest, in place of vnode_init
+ * and vnode_cleanup.
+ */
+void vnode_ctor(struct vnode *);
+void vnode_dtor(struct vnode *);
+int vnode_setup(struct vnode *, const struct vnode_ops *ops,
+		struct fs *fs, void *fsdata);
+void vnode_teardown(struct vnode *);
+
 /*
  * Common stubs for vnode functions that just fail, in various ways.
  */
@@ -45,6 +45,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <vfs.h>
+#include <openfile.h>
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
@@ -112,6 +113,7 @@ boot(void)
 	thread_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
+	openfile_bootstrap();
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
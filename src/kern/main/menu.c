@@ -31,6 +31,7 @@
 #include <kern/errno.h>
 #include <kern/reboot.h>
 #include <kern/unistd.h>
+#include <kern/wait.h>
 #include <limits.h>
 #include <lib.h>
 #include <uio.h>
@@ -43,6 +44,7 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <coremap.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 
@@ -60,11 +62,7 @@
 
 /*
  * Function for a thread that runs an arbitrary userlevel program by
- * name.
- *
- * Note: this cannot pass arguments to the program. You may wish to
- * change it so it can, because that will make testing much easier
- * in the future.
+ * name, passing it the rest of the arguments.
  *
  * It copies the program name because runprogram destroys the copy
  * it gets by passing it to vfs_open().
@@ -79,20 +77,16 @@ cmd_progthread(void *ptr, unsigned long nargs)
 
 	KASSERT(nargs >= 1);
 
-	if (nargs > 2) {
-		kprintf("Warning: argument passing from menu not supported\n");
-	}
-
 	/* Hope we fit. */
 	KASSERT(strlen(args[0]) < sizeof(progname));
 
 	strcpy(progname, args[0]);
 
-	result = runprogram(progname);
+	result = runprogram(progname, args, nargs);
 	if (result) {
 		kprintf("Running program %s failed: %s\n", args[0],
 			strerror(result));
-		return;
+		proc_exit(_MKWAIT_EXIT(1));
 	}
 
 	/* NOTREACHED: runprogram only returns on error. */
@@ -101,20 +95,17 @@ cmd_progthread(void *ptr, unsigned long nargs)
 /*
  * Common code for cmd_prog and cmd_shell.
  *
- * Note that this does not wait for the subprogram to finish, but
- * returns immediately to the menu. This is usually not what you want,
- * so you should have it call your system-calls-assignment waitpid
- * code after forking.
- *
- * Also note that because the subprogram's thread uses the "args"
- * array and strings, until you do this a race condition exists
- * between that code and the menu input code.
+ * This waits for the subprogram to finish before returning to the
+ * menu, which also keeps the menu input code from reusing the "args"
+ * array and strings while the subprogram's thread still needs them.
  */
 static
 int
 common_prog(int nargs, char **args)
 {
 	struct proc *proc;
+	pid_t pid;
+	int status;
 	int result;
 
 	/* Create a process for the new program to run in. */
@@ -129,14 +120,18 @@ common_prog(int nargs, char **args)
 			args /* thread arg */, nargs /* thread arg */);
 	if (result) {
 		kprintf("thread_fork failed: %s\n", strerror(result));
-		proc_destroy(proc);
+		proc_unfork(proc);
 		return result;
 	}
 
-	/*
-	 * The new process will be destroyed when the program exits...
-	 * once you write the code for handling that.
-	 */
+	/* The process is reaped (and destroyed) by waiting for it. */
+	result = proc_wait(proc->p_pid, 0, &status, &pid);
+	KASSERT(result == 0);
+	proc_reap(pid);
+	if (WIFSIGNALED(status)) {
+		kprintf("%s: killed by signal %d\n", args[0],
+			WTERMSIG(status));
+	}
 
 	return 0;
 }
@@ -465,6 +460,30 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lock_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -570,6 +589,7 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] RW lock test                  ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -577,6 +597,7 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[pt]  PID table test                ",
 	NULL
 };
 
@@ -601,6 +622,8 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[lks] Lock contention stats         ",
+	"[cm] Physical memory stats          ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -652,6 +675,8 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "lks",        cmd_lockstats },
+	{ "cm",         cmd_coremapstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -674,6 +699,7 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwtest },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
@@ -707,6 +733,9 @@ static struct {
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
 
+	/* process tests */
+	{ "pt",		pidtest },
+
 	{ NULL, NULL }
 };
 
@@ -40,20 +40,304 @@
  *
  * Unless you're implementing multithreaded user processes, the only
  * process that will have more than one thread is the kernel process.
+ *
+ * The parent/child links, exit status, and PID table are protected by
+ * pid_lock. Each process has a CV that waitpid sleeps on (with
+ * pid_lock) until the process exits. An exiting process gives up
+ * everything but its proc structure and PID; those stay until its
+ * parent reaps it, or go right away if it has no parent left.
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <limits.h>
 #include <spl.h>
+#include <synch.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <openfile.h>
+#include <vfs.h>
+#include <kmem_cache.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * Cache of proc structures. Cached procs keep p_lock initialized.
+ */
+static struct kmem_cache *proc_cache;
+
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->p_waitcv = cv_create("proc");
+	if (proc->p_waitcv == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	spinlock_cleanup(&proc->p_lock);
+	cv_destroy(proc->p_waitcv);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * PID table.
+ *
+ * The table has a power-of-two number of slots, and PID p lives in
+ * slot p & (size - 1), so lookup is one index and a compare. Each
+ * slot remembers the PID it last handed out; when freed, the slot's
+ * next PID is that plus the table size (wrapping around below
+ * PID_MAX), so PIDs aren't reused any sooner than they must be.
+ * Free slots are kept on a FIFO list, so allocation is O(1) and
+ * cycles through all the slots before coming back to one.
+ *
+ * When no slot is free the table doubles, up to PIDTABLE_MAX slots.
+ * Every PID stays in one of the two slots its old slot splits into.
+ */
+
+#define PIDTABLE_INIT	64
+#define PIDTABLE_MAX	8192	/* at most (PID_MAX+1)/4, so 4 PIDs/slot */
+
+#define PIDSLOT_NONE	(-1)
+
+struct pidslot {
+	struct proc *ps_proc;	/* NULL if free */
+	pid_t ps_pid;		/* PID in use, or the next to hand out */
+	int ps_nextfree;	/* free list link */
+};
+
+static struct lock *pid_lock;
+static struct pidslot *pidtable;
+static unsigned pidtable_size;
+static int pidtable_freehead, pidtable_freetail;
+
+/*
+ * Normalize PID as the next PID for slot (PID & (SIZE - 1)): keep it
+ * in [PID_MIN, PID_MAX] without changing its slot.
+ */
+static
+pid_t
+pid_wrap(pid_t pid, unsigned size)
+{
+	if (pid > PID_MAX) {
+		pid &= size - 1;
+	}
+	while (pid < PID_MIN) {
+		pid += size;
+	}
+	return pid;
+}
+
+static
+void
+pidtable_pushfree(unsigned slot)
+{
+	pidtable[slot].ps_proc = NULL;
+	pidtable[slot].ps_nextfree = PIDSLOT_NONE;
+	if (pidtable_freetail == PIDSLOT_NONE) {
+		pidtable_freehead = slot;
+	}
+	else {
+		pidtable[pidtable_freetail].ps_nextfree = slot;
+	}
+	pidtable_freetail = slot;
+}
+
+/*
+ * Double the table. All slots are in use, so each old slot splits
+ * into its own PID's new slot and a free one.
+ */
+static
+int
+pidtable_grow(void)
+{
+	struct pidslot *old, *new;
+	unsigned oldsize, newsize, i, slot;
+	pid_t pid;
+
+	oldsize = pidtable_size;
+	newsize = oldsize * 2;
+	if (newsize > PIDTABLE_MAX) {
+		return ENPROC;
+	}
+	new = kmalloc(newsize * sizeof(*new));
+	if (new == NULL) {
+		return ENOMEM;
+	}
+
+	old = pidtable;
+	pidtable = new;
+	pidtable_size = newsize;
+	for (i = 0; i < oldsize; i++) {
+		KASSERT(old[i].ps_proc != NULL);
+		pid = old[i].ps_pid;
+		slot = pid & (newsize - 1);
+		pidtable[slot].ps_proc = old[i].ps_proc;
+		pidtable[slot].ps_pid = pid;
+		pidtable[slot ^ oldsize].ps_pid =
+			pid_wrap(pid ^ oldsize, newsize);
+		pidtable_pushfree(slot ^ oldsize);
+	}
+	kfree(old);
+	return 0;
+}
+
+static
+int
+pidtable_alloc(struct proc *proc, pid_t *ret)
+{
+	unsigned slot;
+	int result;
+
+	KASSERT(lock_do_i_hold(pid_lock));
+
+	if (pidtable_freehead == PIDSLOT_NONE) {
+		result = pidtable_grow();
+		if (result) {
+			return result;
+		}
+	}
+	slot = pidtable_freehead;
+	pidtable_freehead = pidtable[slot].ps_nextfree;
+	if (pidtable_freehead == PIDSLOT_NONE) {
+		pidtable_freetail = PIDSLOT_NONE;
+	}
+	pidtable[slot].ps_proc = proc;
+	*ret = pidtable[slot].ps_pid;
+	return 0;
+}
+
+static
+void
+pidtable_free(pid_t pid)
+{
+	unsigned slot = pid & (pidtable_size - 1);
+
+	KASSERT(lock_do_i_hold(pid_lock));
+	KASSERT(pidtable[slot].ps_proc != NULL);
+	KASSERT(pidtable[slot].ps_pid == pid);
+
+	pidtable[slot].ps_pid = pid_wrap(pid + pidtable_size, pidtable_size);
+	pidtable_pushfree(slot);
+}
+
+static
+struct proc *
+pidtable_lookup(pid_t pid)
+{
+	unsigned slot;
+
+	KASSERT(lock_do_i_hold(pid_lock));
+
+	if (pid < PID_MIN || pid > PID_MAX) {
+		return NULL;
+	}
+	slot = pid & (pidtable_size - 1);
+	if (pidtable[slot].ps_proc == NULL || pidtable[slot].ps_pid != pid) {
+		return NULL;
+	}
+	return pidtable[slot].ps_proc;
+}
+
+static
+void
+pidtable_bootstrap(void)
+{
+	unsigned i;
+
+	pid_lock = lock_create("pid");
+	pidtable = kmalloc(PIDTABLE_INIT * sizeof(*pidtable));
+	if (pid_lock == NULL || pidtable == NULL) {
+		panic("pidtable_bootstrap: Out of memory\n");
+	}
+	pidtable_size = PIDTABLE_INIT;
+	pidtable_freehead = pidtable_freetail = PIDSLOT_NONE;
+	for (i = 0; i < PIDTABLE_INIT; i++) {
+		pidtable[i].ps_pid = pid_wrap(i, PIDTABLE_INIT);
+		pidtable_pushfree(i);
+	}
+}
+
+/*
+ * Give a new process a PID and make it a child of the current one.
+ */
+static
+int
+proc_adopt(struct proc *proc)
+{
+	struct proc *parent = curproc;
+	int result;
+
+	lock_acquire(pid_lock);
+	result = pidtable_alloc(proc, &proc->p_pid);
+	if (result) {
+		lock_release(pid_lock);
+		return result;
+	}
+	proc->p_parent = parent;
+	proc->p_prevsib = NULL;
+	proc->p_nextsib = parent->p_children;
+	if (parent->p_children != NULL) {
+		parent->p_children->p_prevsib = proc;
+	}
+	parent->p_children = proc;
+	lock_release(pid_lock);
+	return 0;
+}
+
+/*
+ * Take PROC out of its parent's list of children, if it has a
+ * parent, and give up its PID, so it can be destroyed.
+ */
+static
+void
+proc_release(struct proc *proc)
+{
+	struct proc *parent = proc->p_parent;
+
+	KASSERT(lock_do_i_hold(pid_lock));
+	KASSERT(proc->p_children == NULL);
+
+	if (parent != NULL) {
+		if (proc->p_prevsib != NULL) {
+			proc->p_prevsib->p_nextsib = proc->p_nextsib;
+		}
+		else {
+			KASSERT(parent->p_children == proc);
+			parent->p_children = proc->p_nextsib;
+		}
+		if (proc->p_nextsib != NULL) {
+			proc->p_nextsib->p_prevsib = proc->p_prevsib;
+		}
+		proc->p_parent = NULL;
+	}
+	proc->p_nextsib = proc->p_prevsib = NULL;
+	pidtable_free(proc->p_pid);
+	proc->p_pid = 0;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Create a proc structure.
  */
@@ -63,33 +347,42 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
 	proc->p_numthreads = 0;
-	spinlock_init(&proc->p_lock);
+	/* p_lock is set up by proc_ctor */
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_tlbmisses = 0;
+	proc->p_pagefaults = 0;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	proc->p_filetable = NULL;
+
+	/* Process management fields; p_waitcv is set up by proc_ctor */
+	proc->p_pid = 0;
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_nextsib = proc->p_prevsib = NULL;
+	proc->p_exited = false;
+	proc->p_exitstatus = 0;
 
 	return proc;
 }
 
 /*
- * Destroy a proc structure.
- *
- * Note: nothing currently calls this. Your wait/exit code will
- * probably want to do so.
+ * Destroy a proc structure. It must already have been released from
+ * the PID table (see proc_release), if it was ever in it.
  */
 void
 proc_destroy(struct proc *proc)
@@ -112,6 +405,10 @@ proc_destroy(struct proc *proc)
 	 */
 
 	/* VFS fields */
+	if (proc->p_filetable) {
+		filetable_destroy(proc->p_filetable);
+		proc->p_filetable = NULL;
+	}
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
@@ -166,10 +463,17 @@ proc_destroy(struct proc *proc)
 	}
 
 	KASSERT(proc->p_numthreads == 0);
-	spinlock_cleanup(&proc->p_lock);
+	/* p_lock stays initialized; proc_dtor cleans it up. */
+	/* Reaped or never given a PID; see proc_release. */
+	KASSERT(proc->p_pid == 0);
+	KASSERT(proc->p_parent == NULL);
+	KASSERT(proc->p_children == NULL);
+
+	DEBUG(DB_VM, "%s: %u TLB misses, %u page faults\n",
+	      proc->p_name, proc->p_tlbmisses, proc->p_pagefaults);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -178,17 +482,27 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
+
+	pidtable_bootstrap();
 }
 
 /*
  * Create a fresh proc for use by runprogram.
  *
  * It will have no address space and will inherit the current
- * process's (that is, the kernel menu's) current directory.
+ * process's (that is, the kernel menu's) current directory. Its file
+ * table starts out empty; runprogram opens the console in it. It is
+ * a child of the current process, which should wait for it.
  */
 struct proc *
 proc_create_runprogram(const char *name)
@@ -200,6 +514,12 @@ proc_create_runprogram(const char *name)
 		return NULL;
 	}
 
+	newproc->p_filetable = filetable_create();
+	if (newproc->p_filetable == NULL) {
+		proc_destroy(newproc);
+		return NULL;
+	}
+
 	/* VM fields */
 
 	newproc->p_addrspace = NULL;
@@ -218,9 +538,214 @@ proc_create_runprogram(const char *name)
 	}
 	spinlock_release(&curproc->p_lock);
 
+	if (proc_adopt(newproc)) {
+		proc_destroy(newproc);
+		return NULL;
+	}
+
 	return newproc;
 }
 
+/*
+ * Make a copy of the current process for fork: a copy of its address
+ * space, its open files (shared), and its current directory. The
+ * result is a child of the current process with a PID of its own,
+ * but no thread; if it can't be given one, get rid of it with
+ * proc_unfork.
+ */
+int
+proc_fork(struct proc **ret)
+{
+	struct proc *newproc;
+	int result;
+
+	KASSERT(curproc != kproc);
+
+	newproc = proc_create(curproc->p_name);
+	if (newproc == NULL) {
+		return ENOMEM;
+	}
+
+	/* VM fields */
+	result = as_copy(proc_getas(), &newproc->p_addrspace);
+	if (result) {
+		proc_destroy(newproc);
+		return result;
+	}
+
+	/* VFS fields */
+	result = filetable_copy(curproc->p_filetable,
+				&newproc->p_filetable);
+	if (result) {
+		proc_destroy(newproc);
+		return result;
+	}
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != NULL) {
+		VOP_INCREF(curproc->p_cwd);
+		newproc->p_cwd = curproc->p_cwd;
+	}
+	spinlock_release(&curproc->p_lock);
+
+	result = proc_adopt(newproc);
+	if (result) {
+		proc_destroy(newproc);
+		return result;
+	}
+
+	*ret = newproc;
+	return 0;
+}
+
+void
+proc_unfork(struct proc *proc)
+{
+	KASSERT(proc->p_numthreads == 0);
+
+	lock_acquire(pid_lock);
+	proc_release(proc);
+	lock_release(pid_lock);
+	proc_destroy(proc);
+}
+
+/*
+ * Exit the current process.
+ *
+ * First drop everything the process holds (address space, open files,
+ * current directory) and detach the thread, so what is left is only
+ * the proc structure. Then, under pid_lock: orphan the children,
+ * collecting the ones that already exited; record the exit status;
+ * and either wake up a waiting parent or, with no parent, release
+ * the process so it can be destroyed right away. The zombies are
+ * destroyed after pid_lock is dropped.
+ */
+void
+proc_exit(int status)
+{
+	struct proc *proc = curproc;
+	struct proc *child, *next, *reap;
+	struct addrspace *as;
+
+	KASSERT(proc != NULL && proc != kproc);
+
+	as = proc_setas(NULL);
+	as_deactivate();
+	if (as != NULL) {
+		as_destroy(as);
+	}
+	if (proc->p_filetable != NULL) {
+		filetable_destroy(proc->p_filetable);
+		proc->p_filetable = NULL;
+	}
+	if (proc->p_cwd != NULL) {
+		VOP_DECREF(proc->p_cwd);
+		proc->p_cwd = NULL;
+	}
+
+	proc_remthread(curthread);
+
+	/* reap is a list of zombies, linked through p_nextsib */
+	reap = NULL;
+	lock_acquire(pid_lock);
+	for (child = proc->p_children; child != NULL; child = next) {
+		next = child->p_nextsib;
+		child->p_parent = NULL;
+		child->p_nextsib = child->p_prevsib = NULL;
+		if (child->p_exited) {
+			pidtable_free(child->p_pid);
+			child->p_pid = 0;
+			child->p_nextsib = reap;
+			reap = child;
+		}
+	}
+	proc->p_children = NULL;
+
+	proc->p_exitstatus = status;
+	proc->p_exited = true;
+	if (proc->p_parent == NULL) {
+		proc_release(proc);
+		proc->p_nextsib = reap;
+		reap = proc;
+	}
+	else {
+		cv_broadcast(proc->p_waitcv, pid_lock);
+	}
+	lock_release(pid_lock);
+
+	/* After this, our parent may destroy proc at any time. */
+	while (reap != NULL) {
+		next = reap->p_nextsib;
+		reap->p_nextsib = NULL;
+		proc_destroy(reap);
+		reap = next;
+	}
+
+	thread_exit();
+}
+
+/*
+ * Wait for the current process's child PID to exit, and return its
+ * exit status. With WNOHANG, if the child is still running return 0
+ * in *RET instead of waiting; otherwise *RET is PID. The child is
+ * left for proc_reap, so that the caller can finish with the status
+ * (e.g. copy it out to a user buffer, which can fail) before the
+ * child and its PID are gone.
+ */
+int
+proc_wait(pid_t pid, int options, int *status, pid_t *ret)
+{
+	struct proc *child;
+
+	if (options & ~WNOHANG) {
+		return EINVAL;
+	}
+
+	lock_acquire(pid_lock);
+	child = pidtable_lookup(pid);
+	if (child == NULL) {
+		lock_release(pid_lock);
+		return ESRCH;
+	}
+	if (child->p_parent != curproc) {
+		lock_release(pid_lock);
+		return ECHILD;
+	}
+	if (!child->p_exited && (options & WNOHANG)) {
+		lock_release(pid_lock);
+		*ret = 0;
+		return 0;
+	}
+	while (!child->p_exited) {
+		cv_wait(child->p_waitcv, pid_lock);
+	}
+	*status = child->p_exitstatus;
+	lock_release(pid_lock);
+
+	*ret = pid;
+	return 0;
+}
+
+/*
+ * Reap the current process's child PID, which proc_wait has seen
+ * exit. Nobody else can reap it in between: only its parent does
+ * that, and the parent is us.
+ */
+void
+proc_reap(pid_t pid)
+{
+	struct proc *child;
+
+	lock_acquire(pid_lock);
+	child = pidtable_lookup(pid);
+	KASSERT(child != NULL);
+	KASSERT(child->p_parent == curproc);
+	KASSERT(child->p_exited);
+	proc_release(child);
+	lock_release(pid_lock);
+
+	proc_destroy(child);
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -0,0 +1,221 @@
+/*
+ * Argument vectors for execv and runprogram. See execargs.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <execargs.h>
+
+/* The user address just past the page VA is on. */
+#define PAGE_END(va)	(((va) & PAGE_FRAME) + PAGE_SIZE)
+
+static
+int
+execargs_init(struct execargs *ea)
+{
+	ea->ea_buf = kmalloc(ARG_MAX);
+	if (ea->ea_buf == NULL) {
+		return ENOMEM;
+	}
+	ea->ea_len = 0;
+	ea->ea_argc = 0;
+	return 0;
+}
+
+/*
+ * Copy in the user argv array, a page's worth of pointers at a time,
+ * up to and including the NULL, into the front of the buffer.
+ * Reading to the end of each page is safe: the array goes on at
+ * least that far unless the NULL comes first.
+ */
+static
+int
+execargs_copyinptrs(struct execargs *ea, userptr_t argv)
+{
+	userptr_t *ptrs = (userptr_t *)ea->ea_buf;
+	vaddr_t uaddr = (vaddr_t)argv;
+	size_t n, max, chunk, i;
+	int result;
+
+	if (uaddr % sizeof(userptr_t) != 0) {
+		return EFAULT;
+	}
+
+	n = 0;
+	max = ARG_MAX / sizeof(userptr_t);
+	while (1) {
+		chunk = (PAGE_END(uaddr) - uaddr) / sizeof(userptr_t);
+		if (chunk > max - n) {
+			chunk = max - n;
+		}
+		if (chunk == 0) {
+			return E2BIG;
+		}
+		result = copyin((const_userptr_t)uaddr, &ptrs[n],
+				chunk * sizeof(userptr_t));
+		if (result) {
+			return result;
+		}
+		for (i = 0; i < chunk; i++) {
+			if (ptrs[n + i] == NULL) {
+				ea->ea_argc = n + i;
+				return 0;
+			}
+		}
+		n += chunk;
+		uaddr += chunk * sizeof(userptr_t);
+	}
+}
+
+/*
+ * Copy in the argument strings, packed one after another behind the
+ * argv array, and replace each pointer with the string's offset.
+ *
+ * Rather than copyinstr each string, copy a window of user memory a
+ * page at a time and find the strings in it. Arguments usually sit
+ * back to back in user memory (e.g. on the stack of a program that
+ * got them from exec), so one window normally covers many strings.
+ * A string that isn't right after the previous one starts a new
+ * window at its own address. Reading to the end of the page a
+ * string is on is safe, since the string is on that page.
+ *
+ * Bytes past the previous string in the buffer (buf[pos..wend)) hold
+ * user memory starting at uend - (wend - pos).
+ */
+static
+int
+execargs_copyinstrs(struct execargs *ea)
+{
+	userptr_t *ptrs = (userptr_t *)ea->ea_buf;
+	char *buf = ea->ea_buf;
+	size_t pos, wend, chunk;
+	vaddr_t src, uend;
+	int i;
+	int result;
+
+	pos = wend = (ea->ea_argc + 1) * sizeof(userptr_t);
+	uend = 0;
+	for (i = 0; i < ea->ea_argc; i++) {
+		src = (vaddr_t)ptrs[i];
+		if (src != uend - (wend - pos)) {
+			/* Not where the last one ended; new window. */
+			wend = pos;
+			uend = src;
+		}
+		ptrs[i] = (userptr_t)pos;
+
+		while (1) {
+			while (pos < wend && buf[pos] != '\0') {
+				pos++;
+			}
+			if (pos < wend) {
+				/* Found the end of the string. */
+				pos++;
+				break;
+			}
+			chunk = PAGE_END(uend) - uend;
+			if (chunk > ARG_MAX - wend) {
+				chunk = ARG_MAX - wend;
+			}
+			if (chunk == 0) {
+				return E2BIG;
+			}
+			result = copyin((const_userptr_t)uend, buf + wend, chunk);
+			if (result) {
+				return result;
+			}
+			wend += chunk;
+			uend += chunk;
+		}
+	}
+	ea->ea_len = pos;
+	return 0;
+}
+
+int
+execargs_copyin(struct execargs *ea, userptr_t argv)
+{
+	int result;
+
+	result = execargs_init(ea);
+	if (result) {
+		return result;
+	}
+	result = execargs_copyinptrs(ea, argv);
+	if (result == 0) {
+		result = execargs_copyinstrs(ea);
+	}
+	if (result) {
+		execargs_cleanup(ea);
+		return result;
+	}
+	return 0;
+}
+
+int
+execargs_kernel(struct execargs *ea, char **args, unsigned long nargs)
+{
+	userptr_t *ptrs;
+	size_t pos, len;
+	unsigned long i;
+	int result;
+
+	result = execargs_init(ea);
+	if (result) {
+		return result;
+	}
+	ptrs = (userptr_t *)ea->ea_buf;
+
+	pos = (nargs + 1) * sizeof(userptr_t);
+	if (pos > ARG_MAX) {
+		execargs_cleanup(ea);
+		return E2BIG;
+	}
+	for (i = 0; i < nargs; i++) {
+		len = strlen(args[i]) + 1;
+		if (len > ARG_MAX - pos) {
+			execargs_cleanup(ea);
+			return E2BIG;
+		}
+		memcpy(ea->ea_buf + pos, args[i], len);
+		ptrs[i] = (userptr_t)pos;
+		pos += len;
+	}
+	ptrs[nargs] = NULL;
+	ea->ea_argc = nargs;
+	ea->ea_len = pos;
+	return 0;
+}
+
+int
+execargs_copyout(struct execargs *ea, vaddr_t *stackptr, userptr_t *argv)
+{
+	userptr_t *ptrs = (userptr_t *)ea->ea_buf;
+	vaddr_t base;
+	int i;
+	int result;
+
+	/* Keep the stack pointer doubleword-aligned. */
+	base = (*stackptr - ea->ea_len) & ~(vaddr_t)7;
+	for (i = 0; i < ea->ea_argc; i++) {
+		ptrs[i] = (userptr_t)(base + (vaddr_t)ptrs[i]);
+	}
+	result = copyout(ea->ea_buf, (userptr_t)base, ea->ea_len);
+	if (result) {
+		return result;
+	}
+	*stackptr = base;
+	*argv = (userptr_t)base;
+	return 0;
+}
+
+void
+execargs_cleanup(struct execargs *ea)
+{
+	kfree(ea->ea_buf);
+	ea->ea_buf = NULL;
+}
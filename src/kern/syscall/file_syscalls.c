@@ -0,0 +1,243 @@
+/*
+ * File-related system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/limits.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <syscall.h>
+
+/*
+ * open: open PATH and return a new file descriptor for it.
+ */
+int
+sys_open(userptr_t path, int flags, mode_t mode, int *retval)
+{
+	struct openfile *of;
+	char *kpath;
+	int fd;
+	int result;
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(path, kpath, PATH_MAX, NULL);
+	if (result) {
+		kfree(kpath);
+		return result;
+	}
+
+	result = openfile_open(kpath, flags, mode, &of);
+	kfree(kpath);
+	if (result) {
+		return result;
+	}
+
+	result = filetable_place(curproc->p_filetable, of, &fd);
+	if (result) {
+		openfile_decref(of);
+		return result;
+	}
+	*retval = fd;
+	return 0;
+}
+
+/*
+ * Common code for read and write. An error after some data has moved
+ * is dropped in favor of reporting the count.
+ */
+static
+int
+file_rw(int fd, userptr_t buf, size_t len, enum uio_rw rw, int *retval)
+{
+	struct openfile *of;
+	struct iovec iov;
+	struct uio u;
+	struct stat st;
+	size_t done;
+	off_t pos;
+	int result;
+
+	result = filetable_get(curproc->p_filetable, fd, &of);
+	if (result) {
+		return result;
+	}
+	if (of->of_accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+		openfile_decref(of);
+		return EBADF;
+	}
+
+	pos = 0;
+	if (of->of_seekable) {
+		lock_acquire(of->of_lock);
+		pos = of->of_offset;
+		if (rw == UIO_WRITE && of->of_append) {
+			result = VOP_STAT(of->of_vnode, &st);
+			if (result) {
+				goto out;
+			}
+			pos = st.st_size;
+		}
+	}
+
+	iov.iov_ubase = buf;
+	iov.iov_len = len;
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_offset = pos;
+	u.uio_resid = len;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = rw;
+	u.uio_space = proc_getas();
+
+	if (rw == UIO_READ) {
+		result = VOP_READ(of->of_vnode, &u);
+	}
+	else {
+		result = VOP_WRITE(of->of_vnode, &u);
+	}
+	done = len - u.uio_resid;
+	pos = u.uio_offset;
+	if (done > 0) {
+		result = 0;
+	}
+
+	if (of->of_seekable) {
+		of->of_offset = pos;
+	}
+	*retval = done;
+ out:
+	if (of->of_seekable) {
+		lock_release(of->of_lock);
+	}
+	openfile_decref(of);
+	return result;
+}
+
+/*
+ * read: read up to LEN bytes from FD into BUF.
+ */
+int
+sys_read(int fd, userptr_t buf, size_t len, int *retval)
+{
+	return file_rw(fd, buf, len, UIO_READ, retval);
+}
+
+/*
+ * write: write up to LEN bytes from BUF to FD.
+ */
+int
+sys_write(int fd, userptr_t buf, size_t len, int *retval)
+{
+	return file_rw(fd, buf, len, UIO_WRITE, retval);
+}
+
+/*
+ * lseek: move FD's seek position.
+ */
+int
+sys_lseek(int fd, off_t offset, int whence, off_t *retval)
+{
+	struct openfile *of;
+	struct stat st;
+	off_t pos;
+	int result;
+
+	result = filetable_get(curproc->p_filetable, fd, &of);
+	if (result) {
+		return result;
+	}
+	if (!of->of_seekable) {
+		openfile_decref(of);
+		return ESPIPE;
+	}
+
+	lock_acquire(of->of_lock);
+	switch (whence) {
+	    case SEEK_SET:
+		pos = offset;
+		break;
+	    case SEEK_CUR:
+		pos = of->of_offset + offset;
+		break;
+	    case SEEK_END:
+		result = VOP_STAT(of->of_vnode, &st);
+		if (result) {
+			goto out;
+		}
+		pos = st.st_size + offset;
+		break;
+	    default:
+		result = EINVAL;
+		goto out;
+	}
+	if (pos < 0) {
+		result = EINVAL;
+		goto out;
+	}
+	of->of_offset = pos;
+	*retval = pos;
+ out:
+	lock_release(of->of_lock);
+	openfile_decref(of);
+	return result;
+}
+
+/*
+ * close: release FD.
+ */
+int
+sys_close(int fd)
+{
+	struct openfile *of;
+	int result;
+
+	result = filetable_remove(curproc->p_filetable, fd, &of);
+	if (result) {
+		return result;
+	}
+	openfile_decref(of);
+	return 0;
+}
+
+/*
+ * dup2: make NEWFD refer to the same open file as OLDFD, closing
+ * whatever NEWFD referred to before.
+ */
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+	struct filetable *ft = curproc->p_filetable;
+	struct openfile *of, *old;
+	int result;
+
+	if (newfd < 0 || newfd >= OPEN_MAX) {
+		return EBADF;
+	}
+	result = filetable_get(ft, oldfd, &of);
+	if (result) {
+		return result;
+	}
+	if (oldfd != newfd) {
+		result = filetable_set(ft, newfd, of, &old);
+		KASSERT(result == 0);
+		if (old != NULL) {
+			openfile_decref(old);
+		}
+	}
+	openfile_decref(of);
+	*retval = newfd;
+	return 0;
+}
@@ -53,6 +53,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <uio.h>
 #include <proc.h>
 #include <current.h>
@@ -60,6 +61,8 @@
 #include <vnode.h>
 #include <elf.h>
 
+#if OPT_DUMBVM
+
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -145,22 +148,72 @@ load_segment(struct addrspace *as, struct vnode *v,
 	return result;
 }
 
+#else /* !OPT_DUMBVM */
+
 /*
- * Load an ELF executable user program into the current address space.
+ * Set up a segment at virtual address VADDR to be loaded on demand.
+ * The arguments are as above; the VM system reads each page of the
+ * file part in (and zero-fills the rest) when it is first touched.
  *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * as_define_region has already refused regions that reach into
+ * kernel space, so there is no uiomove check to rely on here.
  */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+load_segment(struct addrspace *as, struct vnode *v,
+	     off_t offset, vaddr_t vaddr,
+	     size_t memsize, size_t filesize,
+	     int is_executable)
+{
+	(void)is_executable;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	return as_define_backing(as, vaddr, v, offset, filesize);
+}
+
+#endif /* OPT_DUMBVM */
+
+/*
+ * The parts of an executable's headers needed to load it: the entry
+ * point and the PT_LOAD segments. Executables with more segments
+ * than this can't be loaded; in practice there are two or three.
+ */
+#define ELF_MAXSEGS	8
+
+struct elf_seg {
+	off_t es_offset;	/* where it is in the file */
+	vaddr_t es_vaddr;	/* where it goes in memory */
+	size_t es_memsize;
+	size_t es_filesize;
+	int es_flags;		/* PF_R, PF_W, PF_X */
+};
+
+struct elf_info {
+	vaddr_t ei_entry;
+	unsigned ei_nsegs;
+	struct elf_seg ei_segs[ELF_MAXSEGS];
+};
+
+/*
+ * Read the executable header and the program headers of V and check
+ * them, filling in EI.
+ */
+static
+int
+elf_readheaders(struct vnode *v, struct elf_info *ei)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = proc_getas();
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -202,8 +255,11 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return ENOEXEC;
 	}
 
+	ei->ei_entry = eh.e_entry;
+	ei->ei_nsegs = 0;
+
 	/*
-	 * Go through the list of segments and set up the address space.
+	 * Go through the list of segments and collect the ones to load.
 	 *
 	 * Ordinarily there will be one code segment, one read-only
 	 * data segment, and one data/bss segment, but there might
@@ -243,54 +299,155 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
-		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
-		if (result) {
-			return result;
+		if (ei->ei_nsegs == ELF_MAXSEGS) {
+			kprintf("loadelf: too many segments\n");
+			return ENOEXEC;
 		}
+		ei->ei_segs[ei->ei_nsegs].es_offset = ph.p_offset;
+		ei->ei_segs[ei->ei_nsegs].es_vaddr = ph.p_vaddr;
+		ei->ei_segs[ei->ei_nsegs].es_memsize = ph.p_memsz;
+		ei->ei_segs[ei->ei_nsegs].es_filesize = ph.p_filesz;
+		ei->ei_segs[ei->ei_nsegs].es_flags = ph.p_flags;
+		ei->ei_nsegs++;
 	}
 
-	result = as_prepare_load(as);
-	if (result) {
-		return result;
+	return 0;
+}
+
+/*
+ * Cache of parsed headers, so a program that is run over and over
+ * doesn't have its headers read and checked every time.
+ *
+ * Entries are keyed on the vnode and its version (see vnode.h): the
+ * version changes whenever the file is written, and is never reused
+ * by a later vnode at the same address, so a matching entry always
+ * describes the file as it is now. Entries hold no reference to the
+ * vnode; stale ones just never match again and age out. The least
+ * recently used entry is replaced.
+ */
+#define ELFCACHE_SIZE	16
+
+struct elfcache_entry {
+	struct vnode *ec_vnode;		/* NULL if unused */
+	unsigned ec_version;
+	unsigned ec_lastuse;
+	struct elf_info ec_info;
+};
+
+static struct spinlock elfcache_lock = SPINLOCK_INITIALIZER;
+static struct elfcache_entry elfcache[ELFCACHE_SIZE];
+static unsigned elfcache_clock;
+
+static
+bool
+elfcache_lookup(struct vnode *v, struct elf_info *ei)
+{
+	unsigned i;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode == v &&
+		    elfcache[i].ec_version == v->vn_version) {
+			elfcache[i].ec_lastuse = ++elfcache_clock;
+			*ei = elfcache[i].ec_info;
+			spinlock_release(&elfcache_lock);
+			return true;
+		}
 	}
+	spinlock_release(&elfcache_lock);
+	return false;
+}
+
+/*
+ * Remember EI for V as of VERSION, which must be V's version from
+ * before the headers were read: if the file was written meanwhile,
+ * the entry is already stale and won't be used.
+ */
+static
+void
+elfcache_insert(struct vnode *v, unsigned version, const struct elf_info *ei)
+{
+	unsigned i, victim;
+
+	spinlock_acquire(&elfcache_lock);
+	victim = 0;
+	for (i = 0; i < ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode == v) {
+			/* An older version of the same file. */
+			victim = i;
+			break;
+		}
+		if (elfcache[i].ec_lastuse < elfcache[victim].ec_lastuse) {
+			victim = i;
+		}
+	}
+	elfcache[victim].ec_vnode = v;
+	elfcache[victim].ec_version = version;
+	elfcache[victim].ec_lastuse = ++elfcache_clock;
+	elfcache[victim].ec_info = *ei;
+	spinlock_release(&elfcache_lock);
+}
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct elf_info ei;
+	struct elf_seg *es;
+	unsigned version;
+	unsigned i;
+	int result;
+	struct addrspace *as;
+
+	as = proc_getas();
 
 	/*
-	 * Now actually load each segment.
+	 * Get the headers, from the cache if we can.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
+	if (!elfcache_lookup(v, &ei)) {
+		version = v->vn_version;
+		result = elf_readheaders(v, &ei);
 		if (result) {
 			return result;
 		}
+		elfcache_insert(v, version, &ei);
+	}
 
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
+	/*
+	 * Set up the address space.
+	 */
 
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
+	for (i=0; i<ei.ei_nsegs; i++) {
+		es = &ei.ei_segs[i];
+		result = as_define_region(as,
+					  es->es_vaddr, es->es_memsize,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
+		if (result) {
+			return result;
 		}
+	}
+
+	result = as_prepare_load(as);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Now actually load each segment.
+	 */
 
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+	for (i=0; i<ei.ei_nsegs; i++) {
+		es = &ei.ei_segs[i];
+		result = load_segment(as, v, es->es_offset, es->es_vaddr,
+				      es->es_memsize, es->es_filesize,
+				      es->es_flags & PF_X);
 		if (result) {
 			return result;
 		}
@@ -301,7 +458,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = ei.ei_entry;
 
 	return 0;
 }
@@ -0,0 +1,284 @@
+/*
+ * Open files and file descriptor tables. See openfile.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <kmem_cache.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <openfile.h>
+
+/*
+ * Cache of openfile structures. Cached openfiles keep their locks.
+ */
+static struct kmem_cache *openfile_cache;
+
+static
+int
+openfile_ctor(void *obj)
+{
+	struct openfile *of = obj;
+
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&of->of_reflock);
+	return 0;
+}
+
+static
+void
+openfile_dtor(void *obj)
+{
+	struct openfile *of = obj;
+
+	spinlock_cleanup(&of->of_reflock);
+	lock_destroy(of->of_lock);
+}
+
+void
+openfile_bootstrap(void)
+{
+	openfile_cache = kmem_cache_create("openfile",
+					   sizeof(struct openfile),
+					   openfile_ctor, openfile_dtor);
+	if (openfile_cache == NULL) {
+		panic("openfile_bootstrap: Out of memory\n");
+	}
+}
+
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	struct openfile *of;
+	struct vnode *v;
+	int accmode;
+	int result;
+
+	accmode = flags & O_ACCMODE;
+	if (accmode != O_RDONLY && accmode != O_WRONLY &&
+	    accmode != O_RDWR) {
+		return EINVAL;
+	}
+
+	of = kmem_cache_alloc(openfile_cache);
+	if (of == NULL) {
+		return ENOMEM;
+	}
+
+	result = vfs_open(path, flags, mode, &v);
+	if (result) {
+		kmem_cache_free(openfile_cache, of);
+		return result;
+	}
+
+	of->of_vnode = v;
+	of->of_accmode = accmode;
+	of->of_append = (flags & O_APPEND) != 0;
+	of->of_seekable = VOP_ISSEEKABLE(v);
+	of->of_offset = 0;
+	of->of_refcount = 1;
+
+	*ret = of;
+	return 0;
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount++;
+	spinlock_release(&of->of_reflock);
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+	unsigned refs;
+
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	refs = --of->of_refcount;
+	spinlock_release(&of->of_reflock);
+
+	if (refs == 0) {
+		vfs_close(of->of_vnode);
+		of->of_vnode = NULL;
+		kmem_cache_free(openfile_cache, of);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+	unsigned i;
+
+	ft = kmalloc(sizeof(*ft));
+	if (ft == NULL) {
+		return NULL;
+	}
+	spinlock_init(&ft->ft_lock);
+	for (i = 0; i < OPEN_MAX; i++) {
+		ft->ft_files[i] = NULL;
+	}
+	return ft;
+}
+
+int
+filetable_copy(struct filetable *ft, struct filetable **ret)
+{
+	struct filetable *newft;
+	struct openfile *of;
+	unsigned i;
+
+	newft = filetable_create();
+	if (newft == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	for (i = 0; i < OPEN_MAX; i++) {
+		of = ft->ft_files[i];
+		if (of != NULL) {
+			openfile_incref(of);
+			newft->ft_files[i] = of;
+		}
+	}
+	spinlock_release(&ft->ft_lock);
+
+	*ret = newft;
+	return 0;
+}
+
+void
+filetable_destroy(struct filetable *ft)
+{
+	unsigned i;
+
+	/* Nobody else can see the table any more; no need to lock. */
+	for (i = 0; i < OPEN_MAX; i++) {
+		if (ft->ft_files[i] != NULL) {
+			openfile_decref(ft->ft_files[i]);
+			ft->ft_files[i] = NULL;
+		}
+	}
+	spinlock_cleanup(&ft->ft_lock);
+	kfree(ft);
+}
+
+/*
+ * Open the console for standard input, output, and error. This is
+ * for the first process; everything else inherits them by fork.
+ */
+int
+filetable_stdio(struct filetable *ft)
+{
+	static const int modes[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+	struct openfile *of;
+	char path[5];
+	int fd, i;
+	int result;
+
+	for (i = 0; i < 3; i++) {
+		/* vfs_open destroys the path; give it a fresh copy. */
+		strcpy(path, "con:");
+		result = openfile_open(path, modes[i], 0, &of);
+		if (result) {
+			return result;
+		}
+		result = filetable_place(ft, of, &fd);
+		if (result) {
+			openfile_decref(of);
+			return result;
+		}
+		KASSERT(fd == i);
+	}
+	return 0;
+}
+
+int
+filetable_get(struct filetable *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	of = ft->ft_files[fd];
+	if (of == NULL) {
+		spinlock_release(&ft->ft_lock);
+		return EBADF;
+	}
+	openfile_incref(of);
+	spinlock_release(&ft->ft_lock);
+
+	*ret = of;
+	return 0;
+}
+
+int
+filetable_place(struct filetable *ft, struct openfile *of, int *fd)
+{
+	unsigned i;
+
+	spinlock_acquire(&ft->ft_lock);
+	for (i = 0; i < OPEN_MAX; i++) {
+		if (ft->ft_files[i] == NULL) {
+			ft->ft_files[i] = of;
+			spinlock_release(&ft->ft_lock);
+			*fd = i;
+			return 0;
+		}
+	}
+	spinlock_release(&ft->ft_lock);
+	return EMFILE;
+}
+
+int
+filetable_set(struct filetable *ft, int fd, struct openfile *of,
+	      struct openfile **oldret)
+{
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	openfile_incref(of);
+	spinlock_acquire(&ft->ft_lock);
+	*oldret = ft->ft_files[fd];
+	ft->ft_files[fd] = of;
+	spinlock_release(&ft->ft_lock);
+	return 0;
+}
+
+int
+filetable_remove(struct filetable *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	of = ft->ft_files[fd];
+	ft->ft_files[fd] = NULL;
+	spinlock_release(&ft->ft_lock);
+
+	if (of == NULL) {
+		return EBADF;
+	}
+	*ret = of;
+	return 0;
+}
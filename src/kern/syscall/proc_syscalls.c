@@ -0,0 +1,201 @@
+/*
+ * Process-related system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/wait.h>
+#include <limits.h>
+#include <lib.h>
+#include <mips/trapframe.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <execargs.h>
+#include <syscall.h>
+
+/*
+ * Thread function for the child of fork: the trapframe comes in from
+ * the heap, so copy it to our own stack before going to user mode.
+ */
+static
+void
+fork_child(void *data1, unsigned long data2)
+{
+	struct trapframe *tf = data1;
+
+	(void)data2;
+	enter_forked_process(tf);
+}
+
+/*
+ * fork: make a copy of the current process, returning the child's
+ * PID (and 0 in the child).
+ */
+int
+sys_fork(struct trapframe *tf, int *retval)
+{
+	struct trapframe *childtf;
+	struct proc *child;
+	pid_t pid;
+	int result;
+
+	childtf = kmalloc(sizeof(*childtf));
+	if (childtf == NULL) {
+		return ENOMEM;
+	}
+	*childtf = *tf;
+
+	result = proc_fork(&child);
+	if (result) {
+		kfree(childtf);
+		return result;
+	}
+	/* The child may run, exit, and be reaped before we look again. */
+	pid = child->p_pid;
+
+	result = thread_fork(curthread->t_name, child, fork_child,
+			     childtf, 0);
+	if (result) {
+		proc_unfork(child);
+		kfree(childtf);
+		return result;
+	}
+
+	*retval = pid;
+	return 0;
+}
+
+/*
+ * execv: replace the current program with PROGRAM, passing ARGS.
+ *
+ * The arguments are collected in one kernel buffer in their final
+ * layout (see execargs.h) before the old address space goes away,
+ * and written onto the new user stack with a single copyout.
+ */
+int
+sys_execv(userptr_t program, userptr_t args)
+{
+	struct addrspace *newas, *oldas;
+	struct execargs ea;
+	struct vnode *v;
+	char *path;
+	userptr_t argv;
+	vaddr_t entrypoint, stackptr;
+	int argc;
+	int result;
+
+	path = kmalloc(PATH_MAX);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(program, path, PATH_MAX, NULL);
+	if (result) {
+		kfree(path);
+		return result;
+	}
+
+	result = execargs_copyin(&ea, args);
+	if (result) {
+		kfree(path);
+		return result;
+	}
+
+	/* Load the new program into a new address space. */
+	result = vfs_open(path, O_RDONLY, 0, &v);
+	kfree(path);
+	if (result) {
+		execargs_cleanup(&ea);
+		return result;
+	}
+	newas = as_create();
+	if (newas == NULL) {
+		vfs_close(v);
+		execargs_cleanup(&ea);
+		return ENOMEM;
+	}
+	oldas = proc_setas(newas);
+	as_activate();
+
+	result = load_elf(v, &entrypoint);
+	vfs_close(v);
+	if (result == 0) {
+		result = as_define_stack(newas, &stackptr);
+	}
+	if (result == 0) {
+		result = execargs_copyout(&ea, &stackptr, &argv);
+	}
+	if (result) {
+		proc_setas(oldas);
+		as_activate();
+		as_destroy(newas);
+		execargs_cleanup(&ea);
+		return result;
+	}
+
+	/* Past the point of no return. */
+	as_destroy(oldas);
+	argc = ea.ea_argc;
+	execargs_cleanup(&ea);
+
+	enter_new_process(argc, argv, NULL, stackptr, entrypoint);
+
+	/* enter_new_process does not return. */
+	panic("enter_new_process returned\n");
+	return EINVAL;
+}
+
+/*
+ * waitpid: wait for a child to exit and collect its exit status. The
+ * child is only reaped once the status has been copied out.
+ */
+int
+sys_waitpid(pid_t pid, userptr_t status, int options, int *retval)
+{
+	pid_t ret;
+	int kstatus;
+	int result;
+
+	result = proc_wait(pid, options, &kstatus, &ret);
+	if (result) {
+		return result;
+	}
+	if (ret == 0) {
+		/* WNOHANG, and still running. */
+		*retval = 0;
+		return 0;
+	}
+	if (status != NULL) {
+		result = copyout(&kstatus, status, sizeof(kstatus));
+		if (result) {
+			/* Leave the child for another try. */
+			return result;
+		}
+	}
+	proc_reap(ret);
+	*retval = ret;
+	return 0;
+}
+
+/*
+ * _exit: end the current process.
+ */
+void
+sys__exit(int code)
+{
+	proc_exit(_MKWAIT_EXIT(code));
+}
+
+/*
+ * getpid: return the current process's PID.
+ */
+int
+sys_getpid(int *retval)
+{
+	*retval = curproc->p_pid;
+	return 0;
+}
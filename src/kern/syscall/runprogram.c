@@ -42,36 +42,56 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <vfs.h>
+#include <openfile.h>
+#include <execargs.h>
 #include <syscall.h>
 #include <test.h>
 
 /*
- * Load program "progname" and start running it in usermode.
- * Does not return except on error.
+ * Load program "progname" and start running it in usermode, with the
+ * NARGS arguments ARGS. Does not return except on error.
  *
  * Calls vfs_open on progname and thus may destroy it.
  */
 int
-runprogram(char *progname)
+runprogram(char *progname, char **args, unsigned long nargs)
 {
 	struct addrspace *as;
+	struct execargs ea;
 	struct vnode *v;
 	vaddr_t entrypoint, stackptr;
+	userptr_t argv;
 	int result;
 
+	/* Collect the arguments, in case progname is one of them. */
+	result = execargs_kernel(&ea, args, nargs);
+	if (result) {
+		return result;
+	}
+
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
+		execargs_cleanup(&ea);
 		return result;
 	}
 
 	/* We should be a new process. */
 	KASSERT(proc_getas() == NULL);
 
+	/* Give it standard input, output, and error. */
+	result = filetable_stdio(curproc->p_filetable);
+	if (result) {
+		vfs_close(v);
+		execargs_cleanup(&ea);
+		return result;
+	}
+
 	/* Create a new address space. */
 	as = as_create();
 	if (as == NULL) {
 		vfs_close(v);
+		execargs_cleanup(&ea);
 		return ENOMEM;
 	}
 
@@ -84,6 +104,7 @@ runprogram(char *progname)
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
 		vfs_close(v);
+		execargs_cleanup(&ea);
 		return result;
 	}
 
@@ -94,12 +115,20 @@ runprogram(char *progname)
 	result = as_define_stack(as, &stackptr);
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
+		execargs_cleanup(&ea);
+		return result;
+	}
+
+	/* Put the arguments on it. */
+	result = execargs_copyout(&ea, &stackptr, &argv);
+	nargs = ea.ea_argc;
+	execargs_cleanup(&ea);
+	if (result) {
 		return result;
 	}
 
 	/* Warp to user mode. */
-	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
-			  NULL /*userspace addr of environment*/,
+	enter_new_process(nargs, argv, NULL /*userspace addr of environment*/,
 			  stackptr, entrypoint);
 
 	/* enter_new_process does not return. */
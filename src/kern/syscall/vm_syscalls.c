@@ -0,0 +1,93 @@
+/*
+ * Memory-management system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <openfile.h>
+#include <syscall.h>
+
+/*
+ * sbrk: move the end of the heap, returning the old end.
+ */
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldbreak;
+	int result;
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	result = as_sbrk(as, amount, &oldbreak);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbreak;
+	return 0;
+}
+
+/*
+ * mmap: map a file into memory. The file must be open for reading,
+ * and for writing too if changes are to go back to it. A MAP_SHARED
+ * mapping stays shared with children forked later: they map the same
+ * memory, and see each other's stores right away.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, int32_t *retval)
+{
+	struct openfile *of;
+	vaddr_t base;
+	int result;
+
+	result = filetable_get(curproc->p_filetable, fd, &of);
+	if (result) {
+		return result;
+	}
+	if (of->of_accmode == O_WRONLY ||
+	    ((flags & MAP_SHARED) && (prot & PROT_WRITE) &&
+	     of->of_accmode != O_RDWR)) {
+		openfile_decref(of);
+		return EACCES;
+	}
+
+	result = as_mmap(proc_getas(), (vaddr_t)addr, len, prot, flags,
+			 of->of_vnode, offset, &base);
+	openfile_decref(of);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)base;
+	return 0;
+}
+
+/*
+ * munmap: remove mappings made by mmap.
+ */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	return as_munmap(proc_getas(), (vaddr_t)addr, len);
+}
+
+/*
+ * msync: write back changes to shared mappings. Writing back always
+ * finishes before returning, so MS_ASYNC is the same as MS_SYNC.
+ */
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+	if ((flags & (MS_SYNC | MS_ASYNC)) == (MS_SYNC | MS_ASYNC) ||
+	    (flags & ~(MS_SYNC | MS_ASYNC | MS_INVALIDATE)) != 0) {
+		return EINVAL;
+	}
+	return as_msync(proc_getas(), (vaddr_t)addr, len);
+}
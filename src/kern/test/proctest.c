@@ -0,0 +1,133 @@
+/*
+ * Process tests.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <proc.h>
+#include <test.h>
+
+/* Enough processes to make the PID table (64 slots at boot) grow. */
+#define PIDTEST_NPROCS	300
+
+/*
+ * Check that PROC can be found by its PID: waiting for it with
+ * WNOHANG should say it is still running. (The processes here never
+ * run at all.)
+ */
+static
+void
+pidtest_check(struct proc *proc)
+{
+	pid_t ret;
+	int status;
+	int result;
+
+	result = proc_wait(proc->p_pid, WNOHANG, &status, &ret);
+	if (result) {
+		panic("pidtest: looking up pid %d failed: %s\n",
+		      proc->p_pid, strerror(result));
+	}
+	if (ret != 0) {
+		panic("pidtest: pid %d exited without running\n",
+		      proc->p_pid);
+	}
+}
+
+/*
+ * Check that none of the NUM live processes in PROCS has PROC's PID.
+ */
+static
+void
+pidtest_unique(struct proc **procs, unsigned num, struct proc *proc)
+{
+	unsigned i;
+
+	for (i=0; i<num; i++) {
+		if (procs[i] != NULL && procs[i] != proc &&
+		    procs[i]->p_pid == proc->p_pid) {
+			panic("pidtest: pid %d handed out twice\n",
+			      proc->p_pid);
+		}
+	}
+}
+
+static
+void
+pidtest_make(struct proc **procs, unsigned i)
+{
+	procs[i] = proc_create_runprogram("pidtest");
+	if (procs[i] == NULL) {
+		panic("pidtest: proc_create_runprogram failed\n");
+	}
+	pidtest_unique(procs, PIDTEST_NPROCS, procs[i]);
+}
+
+/*
+ * Create processes until the PID table has grown a few times,
+ * checking after each one that every PID handed out so far can still
+ * be found. Then free every other process, make sure their PIDs are
+ * gone and the others are not, and fill the holes again.
+ */
+int
+pidtest(int nargs, char **args)
+{
+	struct proc **procs;
+	pid_t pid;
+	pid_t ret;
+	int status;
+	unsigned i, j;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting PID table test...\n");
+
+	procs = kmalloc(PIDTEST_NPROCS * sizeof(*procs));
+	if (procs == NULL) {
+		panic("pidtest: Out of memory\n");
+	}
+	for (i=0; i<PIDTEST_NPROCS; i++) {
+		procs[i] = NULL;
+	}
+
+	for (i=0; i<PIDTEST_NPROCS; i++) {
+		pidtest_make(procs, i);
+		for (j=0; j<=i; j++) {
+			pidtest_check(procs[j]);
+		}
+	}
+	kprintf("pidtest: %u processes created\n", PIDTEST_NPROCS);
+
+	for (i=0; i<PIDTEST_NPROCS; i+=2) {
+		pid = procs[i]->p_pid;
+		proc_unfork(procs[i]);
+		procs[i] = NULL;
+		result = proc_wait(pid, WNOHANG, &status, &ret);
+		if (result != ESRCH) {
+			panic("pidtest: freed pid %d still found\n", pid);
+		}
+	}
+	for (i=1; i<PIDTEST_NPROCS; i+=2) {
+		pidtest_check(procs[i]);
+	}
+	kprintf("pidtest: half of them freed\n");
+
+	for (i=0; i<PIDTEST_NPROCS; i+=2) {
+		pidtest_make(procs, i);
+	}
+	for (i=0; i<PIDTEST_NPROCS; i++) {
+		pidtest_check(procs[i]);
+	}
+
+	for (i=0; i<PIDTEST_NPROCS; i++) {
+		proc_unfork(procs[i]);
+	}
+	kfree(procs);
+
+	kprintf("PID table test done\n");
+	return 0;
+}
@@ -399,3 +399,111 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// rwlock test
+
+#define NRWLOOPS      60
+#define RWWRITERS     4		/* one thread in this many is a writer */
+
+static struct rwlock *testrwlock;
+static struct spinlock rwtest_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwtest_readers;
+static volatile unsigned rwtest_writers;
+static volatile bool rwtest_failed;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rwtest_failed = true;
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	unsigned long v1, v2;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % RWWRITERS == 0) {
+			rwlock_acquire_write(testrwlock);
+			spinlock_acquire(&rwtest_lock);
+			if (rwtest_readers != 0 || rwtest_writers != 0) {
+				rwfail(num, "writer not alone");
+			}
+			rwtest_writers++;
+			spinlock_release(&rwtest_lock);
+
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+
+			spinlock_acquire(&rwtest_lock);
+			rwtest_writers--;
+			spinlock_release(&rwtest_lock);
+			rwlock_release_write(testrwlock);
+		}
+		else {
+			rwlock_acquire_read(testrwlock);
+			spinlock_acquire(&rwtest_lock);
+			if (rwtest_writers != 0) {
+				rwfail(num, "reader overlaps writer");
+			}
+			rwtest_readers++;
+			spinlock_release(&rwtest_lock);
+
+			v1 = testval1;
+			thread_yield();
+			v2 = testval2;
+			if (v2 != v1*v1) {
+				rwfail(num, "inconsistent read");
+			}
+
+			spinlock_acquire(&rwtest_lock);
+			rwtest_readers--;
+			spinlock_release(&rwtest_lock);
+			rwlock_release_read(testrwlock);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	testval1 = testval2 = 0;
+	rwtest_failed = false;
+
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+
+	kprintf("rwlock test %s.\n", rwtest_failed ? "failed" : "done");
+	return 0;
+}
@@ -125,6 +125,7 @@ threadlisttest_a(void)
 
 	threadlist_init(&tl);
 	KASSERT(threadlist_isempty(&tl));
+	KASSERT(threadlist_peekhead(&tl) == NULL);
 	threadlist_cleanup(&tl);
 }
 
@@ -168,6 +169,7 @@ threadlisttest_c(void)
 	threadlist_addhead(&tl, fakethreads[0]);
 	threadlist_addhead(&tl, fakethreads[1]);
 	KASSERT(tl.tl_count == 2);
+	KASSERT(threadlist_peekhead(&tl) == fakethreads[1]);
 
 	check_order(&tl, true);
 
@@ -138,6 +138,22 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Spinning parameters for lock_acquire. A waiter spins at most
+ * LOCK_MAXSPIN times around the loop while the holder is running on
+ * another CPU, rechecking the holder's state every LOCK_SPINCHECK
+ * iterations. The total is meant to be well under the cost of a
+ * sleep/wakeup pair.
+ */
+#define LOCK_MAXSPIN	1000
+#define LOCK_SPINCHECK	50
+
+/*
+ * List of all locks, for lock_printstats.
+ */
+static struct lock *alllocks;
+static struct spinlock alllocks_lock = SPINLOCK_INITIALIZER;
+
 struct lock *
 lock_create(const char *name)
 {
@@ -156,7 +172,29 @@ lock_create(const char *name)
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
-        // add stuff here as needed
+	lock->lk_wchan = wchan_create(lock->lk_name);
+	if (lock->lk_wchan == NULL) {
+		kfree(lock->lk_name);
+		kfree(lock);
+		return NULL;
+	}
+
+	spinlock_init(&lock->lk_spinlock);
+	lock->lk_holder = NULL;
+
+	lock->lk_acquires = 0;
+	lock->lk_contended = 0;
+	lock->lk_spinwins = 0;
+	lock->lk_sleeps = 0;
+
+	spinlock_acquire(&alllocks_lock);
+	lock->lk_allprev = NULL;
+	lock->lk_allnext = alllocks;
+	if (alllocks != NULL) {
+		alllocks->lk_allprev = lock;
+	}
+	alllocks = lock;
+	spinlock_release(&alllocks_lock);
 
         return lock;
 }
@@ -165,46 +203,157 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+	KASSERT(lock->lk_holder == NULL);
 
-        // add stuff here as needed
+	spinlock_acquire(&alllocks_lock);
+	if (lock->lk_allprev != NULL) {
+		lock->lk_allprev->lk_allnext = lock->lk_allnext;
+	}
+	else {
+		KASSERT(alllocks == lock);
+		alllocks = lock->lk_allnext;
+	}
+	if (lock->lk_allnext != NULL) {
+		lock->lk_allnext->lk_allprev = lock->lk_allprev;
+	}
+	spinlock_release(&alllocks_lock);
 
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&lock->lk_spinlock);
+	wchan_destroy(lock->lk_wchan);
         kfree(lock->lk_name);
         kfree(lock);
 }
 
+/*
+ * Return true if it's worth spinning for LOCK: that is, if the holder
+ * is on a CPU right now. Since we aren't the holder, S_RUN means it
+ * is running on some other CPU. The lock's spinlock must be held,
+ * which keeps the holder from releasing the lock (and so from
+ * exiting) under us.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+
+	return lock->lk_holder != NULL && lock->lk_holder->t_state == S_RUN;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	unsigned spins, i;
+
+	KASSERT(lock != NULL);
+
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
+
+	/* Locks are not recursive. */
+	KASSERT(lock->lk_holder != curthread);
+
+	spinlock_acquire(&lock->lk_spinlock);
+
 	/* Call this (atomically) before waiting for a lock */
-	//HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
-        // Write this
+	lock->lk_acquires++;
+	if (lock->lk_holder != NULL) {
+		lock->lk_contended++;
 
-        (void)lock;  // suppress warning until code gets written
+		/*
+		 * Spin phase. Drop the spinlock (and so let
+		 * interrupts in) while polling the holder field, so
+		 * the holder can get at the spinlock to release.
+		 */
+		spins = 0;
+		while (spins < LOCK_MAXSPIN && lock_holder_running(lock)) {
+			spinlock_release(&lock->lk_spinlock);
+			for (i=0; i<LOCK_SPINCHECK; i++) {
+				if (lock->lk_holder == NULL) {
+					break;
+				}
+			}
+			spins += i;
+			spinlock_acquire(&lock->lk_spinlock);
+		}
+		if (lock->lk_holder == NULL) {
+			lock->lk_spinwins++;
+		}
+
+		/* Sleep phase. */
+		while (lock->lk_holder != NULL) {
+			lock->lk_sleeps++;
+			wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
+		}
+	}
+	lock->lk_holder = curthread;
 
 	/* Call this (atomically) once the lock is acquired */
-	//HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+
+	spinlock_release(&lock->lk_spinlock);
 }
 
 void
 lock_release(struct lock *lock)
 {
+	KASSERT(lock != NULL);
+	KASSERT(lock->lk_holder == curthread);
+
+	spinlock_acquire(&lock->lk_spinlock);
+
 	/* Call this (atomically) when the lock is released */
-	//HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
 
-        // Write this
+	lock->lk_holder = NULL;
+	wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
 
-        (void)lock;  // suppress warning until code gets written
+	spinlock_release(&lock->lk_spinlock);
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-        // Write this
+	KASSERT(lock != NULL);
+
+	/*
+	 * No need to lock: if the answer is yes it can't change
+	 * behind our back, and if it's no it can't become yes.
+	 */
+	return lock->lk_holder == curthread;
+}
 
-        (void)lock;  // suppress warning until code gets written
+/*
+ * Print the contention counters of all locks that have ever been
+ * contended. The counters of each lock are read without its spinlock,
+ * so the numbers for a busy lock may be slightly inconsistent.
+ */
+void
+lock_printstats(void)
+{
+	struct lock *lock;
+	unsigned nlocks = 0;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&alllocks_lock);
+
+	kprintf("%-24s %10s %10s %10s %10s\n", "lock", "acquires",
+		"contended", "spinwins", "sleeps");
+	for (lock = alllocks; lock != NULL; lock = lock->lk_allnext) {
+		nlocks++;
+		if (lock->lk_contended == 0) {
+			continue;
+		}
+		kprintf("%-24.24s %10u %10u %10u %10u\n", lock->lk_name,
+			lock->lk_acquires, lock->lk_contended,
+			lock->lk_spinwins, lock->lk_sleeps);
+	}
+	kprintf("%u locks, uncontended ones not shown\n", nlocks);
 
-        return true; // dummy until code gets written
+	spinlock_release(&alllocks_lock);
 }
 
 ////////////////////////////////////////////////////////////
@@ -228,7 +377,14 @@ cv_create(const char *name)
                 return NULL;
         }
 
-        // add stuff here as needed
+	cv->cv_wchan = wchan_create(cv->cv_name);
+	if (cv->cv_wchan == NULL) {
+		kfree(cv->cv_name);
+		kfree(cv);
+		return NULL;
+	}
+
+	spinlock_init(&cv->cv_lock);
 
         return cv;
 }
@@ -238,8 +394,9 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        // add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&cv->cv_lock);
+	wchan_destroy(cv->cv_wchan);
         kfree(cv->cv_name);
         kfree(cv);
 }
@@ -247,23 +404,186 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-        // Write this
-        (void)cv;    // suppress warning until code gets written
-        (void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	/*
+	 * Take the cv spinlock before dropping the lock, so a signal
+	 * sent in between can't be lost.
+	 */
+	spinlock_acquire(&cv->cv_lock);
+	lock_release(lock);
+	wchan_sleep(cv->cv_wchan, &cv->cv_lock);
+	spinlock_release(&cv->cv_lock);
+	lock_acquire(lock);
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-        // Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&cv->cv_lock);
+	wchan_wakeone(cv->cv_wchan, &cv->cv_lock);
+	spinlock_release(&cv->cv_lock);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&cv->cv_lock);
+	wchan_wakeall(cv->cv_wchan, &cv->cv_lock);
+	spinlock_release(&cv->cv_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rwlock;
+
+	rwlock = kmalloc(sizeof(*rwlock));
+	if (rwlock == NULL) {
+		return NULL;
+	}
+
+	rwlock->rwlock_name = kstrdup(name);
+	if (rwlock->rwlock_name == NULL) {
+		kfree(rwlock);
+		return NULL;
+	}
+
+	HANGMAN_LOCKABLEINIT(&rwlock->rwlock_hangman, rwlock->rwlock_name);
+
+	rwlock->rwlock_readwchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rwlock_readwchan == NULL) {
+		kfree(rwlock->rwlock_name);
+		kfree(rwlock);
+		return NULL;
+	}
+
+	rwlock->rwlock_writewchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rwlock_writewchan == NULL) {
+		wchan_destroy(rwlock->rwlock_readwchan);
+		kfree(rwlock->rwlock_name);
+		kfree(rwlock);
+		return NULL;
+	}
+
+	spinlock_init(&rwlock->rwlock_lock);
+	rwlock->rwlock_readers = 0;
+	rwlock->rwlock_waitingwriters = 0;
+	rwlock->rwlock_writer = NULL;
+
+	return rwlock;
+}
+
+void
+rwlock_destroy(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+	KASSERT(rwlock->rwlock_readers == 0);
+	KASSERT(rwlock->rwlock_waitingwriters == 0);
+	KASSERT(rwlock->rwlock_writer == NULL);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rwlock->rwlock_lock);
+	wchan_destroy(rwlock->rwlock_writewchan);
+	wchan_destroy(rwlock->rwlock_readwchan);
+	kfree(rwlock->rwlock_name);
+	kfree(rwlock);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rwlock->rwlock_writer != curthread);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+	/* Writer preference: queue behind waiting writers too. */
+	while (rwlock->rwlock_writer != NULL ||
+	       rwlock->rwlock_waitingwriters > 0) {
+		wchan_sleep(rwlock->rwlock_readwchan, &rwlock->rwlock_lock);
+	}
+	rwlock->rwlock_readers++;
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+	KASSERT(rwlock->rwlock_readers > 0);
+	KASSERT(rwlock->rwlock_writer == NULL);
+	rwlock->rwlock_readers--;
+	if (rwlock->rwlock_readers == 0) {
+		/* Readers only ever wait for writers, so wake one of those. */
+		wchan_wakeone(rwlock->rwlock_writewchan, &rwlock->rwlock_lock);
+	}
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rwlock->rwlock_writer != curthread);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+
+	/* Call this (atomically) before waiting for a lock */
+	HANGMAN_WAIT(&curthread->t_hangman, &rwlock->rwlock_hangman);
+
+	rwlock->rwlock_waitingwriters++;
+	while (rwlock->rwlock_writer != NULL || rwlock->rwlock_readers > 0) {
+		wchan_sleep(rwlock->rwlock_writewchan, &rwlock->rwlock_lock);
+	}
+	rwlock->rwlock_waitingwriters--;
+	rwlock->rwlock_writer = curthread;
+
+	/* Call this (atomically) once the lock is acquired */
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rwlock->rwlock_hangman);
+
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+	KASSERT(rwlock->rwlock_writer == curthread);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+
+	/* Call this (atomically) when the lock is released */
+	HANGMAN_RELEASE(&curthread->t_hangman, &rwlock->rwlock_hangman);
+
+	rwlock->rwlock_writer = NULL;
+	if (rwlock->rwlock_waitingwriters > 0) {
+		wchan_wakeone(rwlock->rwlock_writewchan, &rwlock->rwlock_lock);
+	}
+	else {
+		wchan_wakeall(rwlock->rwlock_readwchan, &rwlock->rwlock_lock);
+	}
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rwlock)
+{
+	KASSERT(rwlock != NULL);
+
+	return rwlock->rwlock_writer == curthread;
 }
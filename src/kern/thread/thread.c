@@ -50,6 +50,9 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmem_cache.h>
+#include <coremap.h>
+#include "opt-dumbvm.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -69,6 +72,13 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/*
+ * Caches for thread structures and kernel stacks, so thread_fork and
+ * thread_destroy don't go through kmalloc every time.
+ */
+static struct kmem_cache *thread_cache;
+static struct kmem_cache *thread_stack_cache;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -108,6 +118,29 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Constructor and destructor for thread_cache. The list node's
+ * self-pointer never changes, so it only needs setting once.
+ */
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_init(&thread->t_listnode, thread);
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_cleanup(&thread->t_listnode);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -120,14 +153,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -135,12 +168,14 @@ thread_create(const char *name)
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
+	/* t_listnode is set up by thread_ctor */
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+	thread->t_priority = 0;
+	thread->t_quantum_used = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -179,6 +214,9 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_tlbfree = 0;
+	c->c_asidgen = 0;
+	c->c_asid = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -210,7 +248,7 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		c->c_curthread->t_stack = kmem_cache_alloc(thread_stack_cache);
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -275,16 +313,18 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		kmem_cache_free(thread_stack_cache, thread->t_stack);
 	}
-	threadlistnode_cleanup(&thread->t_listnode);
+	/* t_listnode stays initialized for reuse; see thread_dtor */
+	KASSERT(thread->t_listnode.tln_prev == NULL);
+	KASSERT(thread->t_listnode.tln_next == NULL);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -373,6 +413,14 @@ thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, thread_dtor);
+	thread_stack_cache = kmem_cache_create("thread stack", STACK_SIZE,
+					       NULL, NULL);
+	if (thread_cache == NULL || thread_stack_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -442,6 +490,54 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Wake up some idle cpu other than BUSY, so it can come and steal
+ * work from BUSY's run queue (see thread_steal).
+ *
+ * The c_isidle flags are read without their runqueue locks; this is
+ * only a hint. If we miss a cpu that just went idle, it will find the
+ * work on its next timer interrupt; if we wake one that just unidled,
+ * it takes a spurious interrupt.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Put a thread on a run queue. Run queues are kept sorted by
+ * priority, highest (numerically lowest) first, and round-robin
+ * within each level, so the thread goes after every thread of the
+ * same or higher priority. Searching from the tail makes the common
+ * case of equal priorities cheap.
+ */
+static
+void
+thread_enqueue(struct threadlist *runqueue, struct thread *target)
+{
+	struct thread *t;
+
+	THREADLIST_FORALL_REV(t, *runqueue) {
+		if (t->t_priority <= target->t_priority) {
+			threadlist_insertafter(runqueue, t, target);
+			return;
+		}
+	}
+	threadlist_addhead(runqueue, target);
+}
+
 /*
  * Make a thread runnable.
  *
@@ -452,6 +548,7 @@ void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
+	bool kick;
 
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
@@ -464,9 +561,17 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
+	if (target->t_state == S_SLEEP) {
+		/* It blocked before using up its quantum; boost it. */
+		if (target->t_priority > 0) {
+			target->t_priority--;
+		}
+		target->t_quantum_used = 0;
+	}
+
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_enqueue(&targetcpu->c_runqueue, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -476,8 +581,25 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
 
+	/*
+	 * If the target is busy and this makes a backlog of more than
+	 * one thread waiting, get an idle processor to take some of
+	 * it. A single waiting thread is left where it is; it will
+	 * probably run soon on the cpu whose cache it likes, and an
+	 * idle cpu still finds it on its next timer interrupt. The
+	 * scan for an idle cpu happens after the runqueue lock is
+	 * dropped. (With the lock already held, our caller is putting
+	 * itself back on its own queue and is about to pick a thread
+	 * anyway; no kick.)
+	 */
+	kick = !targetcpu->c_isidle &&
+		targetcpu->c_runqueue.tl_count > 1;
+
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
+		if (kick) {
+			thread_kick_idle(targetcpu);
+		}
 	}
 }
 
@@ -506,7 +628,7 @@ thread_fork(const char *name,
 	}
 
 	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	newthread->t_stack = kmem_cache_alloc(thread_stack_cache);
 	if (newthread->t_stack == NULL) {
 		thread_destroy(newthread);
 		return ENOMEM;
@@ -547,6 +669,8 @@ thread_fork(const char *name,
 	return 0;
 }
 
+static struct thread *thread_steal(void);
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -644,7 +768,29 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/*
+			 * Before actually idling, try to steal a
+			 * thread from another cpu's run queue. A
+			 * stolen thread is not put on our own run
+			 * queue; we just run it.
+			 */
+			next = thread_steal();
+#if OPT_DUMBVM
+			if (next == NULL) {
+				cpu_idle();
+			}
+#else
+			/*
+			 * Nothing to run; zero a page for the VM
+			 * system if it wants one (this keeps
+			 * interrupts off for as long as that takes),
+			 * otherwise sleep. dumbvm never asks for
+			 * zeroed pages, so it doesn't get any.
+			 */
+			if (next == NULL && !coremap_zeroidle()) {
+				cpu_idle();
+			}
+#endif
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -783,10 +929,12 @@ thread_exit(void)
 	cur = curthread;
 
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * Detach from our process, unless proc_exit already did so
+	 * before handing the process over to be reaped.
 	 */
-	proc_remthread(cur);
+	if (cur->t_proc != NULL) {
+		proc_remthread(cur);
+	}
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -814,139 +962,165 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. There are MLFQ_LEVELS
+ * priority levels; run queues are kept in priority order (see
+ * thread_enqueue), so a cpu always runs its highest-priority ready
+ * thread, round-robin within a level.
+ *
+ * New threads start at the top level, and a thread keeps the cpu
+ * until it has used up the quantum for its level or a thread of
+ * higher priority is waiting (see thread_tick). A thread that uses up
+ * its quantum drops to the next level down; quanta double as priority
+ * drops, so cpu-bound threads run less often but for longer at a
+ * stretch. A thread that blocks (on disk I/O, console input, and so
+ * on) moves up a level when woken. Every MLFQ_BOOST_HARDCLOCKS
+ * everything on the cpu is put back at the top, so that threads whose
+ * behavior changes are not stuck at the bottom and low-priority
+ * threads cannot starve.
  */
 
-void
-schedule(void)
+#define MLFQ_LEVELS		4
+#define MLFQ_QUANTUM(level)	(1U << (level))	/* in hardclocks */
+#define MLFQ_BOOST_HARDCLOCKS	100		/* multiple of SCHEDULE_HARDCLOCKS */
+
+/*
+ * Charge the current thread for one hardclock, and return true if it
+ * should yield: either its quantum is used up, in which case it also
+ * drops a level, or a higher-priority thread is first in line on the
+ * run queue. Called from hardclock() with interrupts off.
+ */
+bool
+thread_tick(void)
 {
+	struct thread *cur, *next;
+	bool yield;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * If the cpu is idle, curthread is just whatever ran last;
+	 * don't charge it.
 	 */
+	if (curcpu->c_isidle) {
+		return false;
+	}
+
+	cur = curthread;
+	cur->t_quantum_used++;
+	if (cur->t_quantum_used >= MLFQ_QUANTUM(cur->t_priority)) {
+		if (cur->t_priority < MLFQ_LEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_quantum_used = 0;
+		return true;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	next = threadlist_peekhead(&curcpu->c_runqueue);
+	yield = next != NULL && next->t_priority < cur->t_priority;
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return yield;
+}
+
+/*
+ * Periodic priority boost. This is called from hardclock() every
+ * SCHEDULE_HARDCLOCKS, with interrupts off.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+
+	if ((curcpu->c_hardclocks % MLFQ_BOOST_HARDCLOCKS) == 0) {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		THREADLIST_FORALL(t, curcpu->c_runqueue) {
+			t->t_priority = 0;
+			t->t_quantum_used = 0;
+		}
+		spinlock_release(&curcpu->c_runqueue_lock);
+		if (!curcpu->c_isidle) {
+			curthread->t_priority = 0;
+			curthread->t_quantum_used = 0;
+		}
+	}
 }
 
 /*
  * Thread migration.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * Load is balanced by work stealing: when a cpu runs out of threads,
+ * before idling it takes one from the tail of the longest run queue
+ * among the other cpus. The tail is the thread that would otherwise
+ * wait longest, and is least likely to still have useful cache state
+ * on its old cpu; the head stays put. Busy cpus wake an idle one
+ * (thread_kick_idle) when they queue a thread they cannot run right
+ * away, and idle cpus retry on every timer interrupt, so imbalance
+ * lasts at most one tick rather than until the next periodic push.
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
+ * which is fairly slow. Stealing only when otherwise idle keeps that
+ * cost off cpus that have work of their own.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Called from thread_switch with interrupts off and no runqueue lock
+ * held. Returns the stolen thread, or NULL if there was nothing to
+ * steal.
  */
-void
-thread_consider_migration(void)
+static
+struct thread *
+thread_steal(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
+	unsigned i, numcpus, count, best_count;
+	struct cpu *c, *victim;
 	struct thread *t;
 
-	my_count = total_count = 0;
+	/*
+	 * Pick the busiest other cpu. The counts are read unlocked as
+	 * a hint; the victim's queue is checked again under its lock.
+	 * A cpu that is itself idle is about to run whatever it has
+	 * queued, so leave it alone.
+	 */
+	victim = NULL;
+	best_count = 0;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		count = c->c_runqueue.tl_count;
+		if (count > best_count) {
+			best_count = count;
+			victim = c;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
-
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	if (victim == NULL) {
+		return NULL;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = threadlist_remtail(&victim->c_runqueue);
+	if (t != NULL && t == victim->c_curthread) {
+		/*
+		 * Ordinarily, a cpu's curthread will not appear on
+		 * its run queue. However, it can if the thread went
+		 * to sleep, the cpu went idle (so it remained
+		 * curthread), and the thread was woken before the
+		 * cpu unidled. Its context hasn't been saved yet, so
+		 * it must not be run elsewhere; put it back.
+		 */
+		threadlist_addtail(&victim->c_runqueue, t);
+		t = NULL;
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
-
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
-		spinlock_release(&c->c_runqueue_lock);
+	if (t != NULL) {
+		KASSERT(t->t_state == S_READY);
+		t->t_cpu = curcpu->c_self;
 	}
+	spinlock_release(&victim->c_runqueue_lock);
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+	if (t != NULL) {
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
 	}
-
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	return t;
 }
 
 ////////////////////////////////////////////////////////////
@@ -1136,23 +1310,14 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 
 	spinlock_acquire(&target->c_ipi_lock);
 
+	/*
+	 * Every sender waits for its shootdowns to be done, so there
+	 * is at most one request queued here from each other CPU.
+	 */
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
-	}
+	KASSERT(n < TLBSHOOTDOWN_MAX);
+	target->c_shootdown[n] = *mapping;
+	target->c_numshootdown = n+1;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
@@ -1160,6 +1325,49 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to all CPUs except the current one.
+ * Returns the number of CPUs it was sent to.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * Send a TLB shootdown IPI to the CPUs in the bitmask CPUS, except
+ * the current one. Returns the number of CPUs it was sent to.
+ */
+unsigned
+ipi_tlbshootdown_cpus(uint32_t cpus, const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self && c->c_number < 32 &&
+		    (cpus & ((uint32_t)1 << c->c_number))) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
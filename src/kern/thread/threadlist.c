@@ -96,6 +96,15 @@ threadlist_isempty(struct threadlist *tl)
 	return (tl->tl_count == 0);
 }
 
+struct thread *
+threadlist_peekhead(struct threadlist *tl)
+{
+	DEBUGASSERT(tl != NULL);
+
+	/* NULL (the tail bookend's tln_self) if the list is empty */
+	return tl->tl_head.tln_next->tln_self;
+}
+
 ////////////////////////////////////////////////////////////
 // internal
 
@@ -30,12 +30,50 @@
 /*
  * Basic vnode support functions.
  */
+
+#define VNODEINLINE
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <textcache.h>
+
+/*
+ * Source of initial vnode versions (see vnode.h). Every version a
+ * reclaimed vnode ever had is below vnode_nextversion, so a new vnode
+ * at the same address starts out with a version never seen there.
+ */
+static struct spinlock vnode_versionlock = SPINLOCK_INITIALIZER;
+static unsigned vnode_nextversion;
+
+/*
+ * Set up the parts of an abstract vnode that last across uses of the
+ * memory in an object cache.
+ */
+void
+vnode_ctor(struct vnode *vn)
+{
+	KASSERT(vn != NULL);
+
+	spinlock_init(&vn->vn_countlock);
+	vn->vn_ops = NULL;
+	vn->vn_refcount = 0;
+}
+
+/*
+ * Undo vnode_ctor.
+ */
+void
+vnode_dtor(struct vnode *vn)
+{
+	KASSERT(vn->vn_ops == NULL);
+
+	spinlock_cleanup(&vn->vn_countlock);
+}
 
 /*
  * Initialize an abstract vnode.
@@ -43,13 +81,29 @@
 int
 vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	   struct fs *fs, void *fsdata)
+{
+	vnode_ctor(vn);
+	return vnode_setup(vn, ops, fs, fsdata);
+}
+
+/*
+ * Initialize an abstract vnode that vnode_ctor has already been
+ * called on.
+ */
+int
+vnode_setup(struct vnode *vn, const struct vnode_ops *ops,
+	    struct fs *fs, void *fsdata)
 {
 	KASSERT(vn != NULL);
 	KASSERT(ops != NULL);
+	KASSERT(vn->vn_ops == NULL);
 
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
-	spinlock_init(&vn->vn_countlock);
+	spinlock_acquire(&vnode_versionlock);
+	vn->vn_version = vnode_nextversion++;
+	spinlock_release(&vnode_versionlock);
+	vn->vn_textcached = false;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -60,10 +114,29 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
  */
 void
 vnode_cleanup(struct vnode *vn)
+{
+	vnode_teardown(vn);
+	vnode_dtor(vn);
+}
+
+/*
+ * Undo vnode_setup, leaving the vnode ready for vnode_setup or
+ * vnode_dtor.
+ */
+void
+vnode_teardown(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
 
-	spinlock_cleanup(&vn->vn_countlock);
+	if (vn->vn_textcached) {
+		textcache_purge(vn);
+	}
+
+	spinlock_acquire(&vnode_versionlock);
+	if (vn->vn_version >= vnode_nextversion) {
+		vnode_nextversion = vn->vn_version + 1;
+	}
+	spinlock_release(&vnode_versionlock);
 
 	vn->vn_ops = NULL;
 	vn->vn_refcount = 0;
@@ -122,6 +195,26 @@ vnode_decref(struct vnode *vn)
 	}
 }
 
+/*
+ * Give a vnode a new version.
+ * Called by VOP_WRITE and VOP_TRUNCATE, after the operation.
+ */
+void
+vnode_newversion(struct vnode *vn)
+{
+	bool purge;
+
+	spinlock_acquire(&vn->vn_countlock);
+	vn->vn_version++;
+	purge = vn->vn_textcached;
+	vn->vn_textcached = false;
+	spinlock_release(&vn->vn_countlock);
+
+	if (purge) {
+		textcache_purge(vn);
+	}
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
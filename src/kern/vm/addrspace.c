@@ -27,12 +27,18 @@
  * SUCH DAMAGE.
  */
 
+
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
+#include <stat.h>
+#include <synch.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <vnode.h>
+#include <pagetable.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -40,6 +46,12 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+/*
+ * Size of the user stack region. Stack pages are only allocated as
+ * they are touched, so this can be generous.
+ */
+#define VM_STACKPAGES	1024
+
 struct addrspace *
 as_create(void)
 {
@@ -50,40 +62,269 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_regions = NULL;
+	as->as_heap = NULL;
+	as->as_heapend = 0;
+	as->as_faultnext = 0;
+	as->as_faultwin = 0;
+	as->as_asid = 0;
+	as->as_cpus = 0;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
 
 	return as;
 }
 
+/*
+ * Return a region other than SKIP that overlaps BASE to TOP, or NULL
+ * if there isn't one.
+ */
+static
+struct vm_region *
+as_overlaps(struct addrspace *as, vaddr_t base, vaddr_t top,
+	    struct vm_region *skip)
+{
+	struct vm_region *vr;
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vr != skip &&
+		    base < vr->vr_base + vr->vr_npages * PAGE_SIZE &&
+		    vr->vr_base < top) {
+			return vr;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Make a region and put it on the address space's list. Fails with
+ * EINVAL if it would overlap an existing region.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t base, size_t npages,
+	     bool writeable, struct vm_region **ret)
+{
+	struct vm_region *vr;
+
+	if (as_overlaps(as, base, base + npages * PAGE_SIZE, NULL) != NULL) {
+		return EINVAL;
+	}
+
+	vr = kmalloc(sizeof(*vr));
+	if (vr == NULL) {
+		return ENOMEM;
+	}
+	vr->vr_base = base;
+	vr->vr_npages = npages;
+	vr->vr_writeable = writeable;
+	vr->vr_mapped = false;
+	vr->vr_shared = false;
+	vr->vr_vnode = NULL;
+	vr->vr_fileoffset = 0;
+	vr->vr_filevaddr = 0;
+	vr->vr_filesize = 0;
+	vr->vr_object = NULL;
+
+	vr->vr_next = as->as_regions;
+	as->as_regions = vr;
+	if (ret != NULL) {
+		*ret = vr;
+	}
+	return 0;
+}
+
+/*
+ * Write back the pages from LO to HI of shared mapping VR, including
+ * those only its page object has. Returns
+ * the first error, but tries all the pages regardless.
+ */
+static
+int
+as_syncrange(struct addrspace *as, struct vm_region *vr,
+	     vaddr_t lo, vaddr_t hi)
+{
+	vaddr_t va;
+	pte_t *pte;
+	int result, err;
+
+	result = 0;
+	for (va = lo; va < hi; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if ((pte != NULL && *pte != 0) || vr->vr_object != NULL) {
+			err = vm_writeback(as, vr, va, pte);
+			if (err && result == 0) {
+				result = err;
+			}
+		}
+	}
+	return result;
+}
+
+/*
+ * Free a region's resident pages and the region itself, writing
+ * back shared mapped pages first. The caller has already unlinked
+ * it.
+ */
+static
+void
+as_freeregion(struct addrspace *as, struct vm_region *vr)
+{
+	vaddr_t va;
+	size_t i;
+	pte_t *pte;
+	int result;
+
+	if (vr->vr_shared) {
+		result = as_syncrange(as, vr, vr->vr_base,
+				      vr->vr_base + vr->vr_npages * PAGE_SIZE);
+		if (result) {
+			/* Nobody left to tell. */
+			kprintf("vm: writing back mapped file: %s\n",
+				strerror(result));
+		}
+	}
+
+	for (i = 0; i < vr->vr_npages; i++) {
+		va = vr->vr_base + i * PAGE_SIZE;
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte != NULL && *pte != 0) {
+			vm_freepage(pte);
+		}
+	}
+	if (vr->vr_object != NULL) {
+		vm_object_decref(vr->vr_object);
+	}
+	if (vr->vr_vnode != NULL) {
+		VOP_DECREF(vr->vr_vnode);
+	}
+	kfree(vr);
+}
+
+struct vm_region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_region *vr;
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vaddr >= vr->vr_base &&
+		    vaddr < vr->vr_base + vr->vr_npages * PAGE_SIZE) {
+			return vr;
+		}
+	}
+	return NULL;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct vm_region *vr, *newvr;
+	vaddr_t va;
+	size_t i;
+	pte_t *oldpte, *newpte;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	lock_acquire(old->as_lock);
+	for (vr = old->as_regions; vr != NULL; vr = vr->vr_next) {
+		result = as_addregion(newas, vr->vr_base, vr->vr_npages,
+				      vr->vr_writeable, &newvr);
+		if (result) {
+			goto fail;
+		}
+		if (vr == old->as_heap) {
+			newas->as_heap = newvr;
+			newas->as_heapend = old->as_heapend;
+		}
+		newvr->vr_mapped = vr->vr_mapped;
+		newvr->vr_shared = vr->vr_shared;
+		if (vr->vr_vnode != NULL) {
+			VOP_INCREF(vr->vr_vnode);
+			newvr->vr_vnode = vr->vr_vnode;
+			newvr->vr_fileoffset = vr->vr_fileoffset;
+			newvr->vr_filevaddr = vr->vr_filevaddr;
+			newvr->vr_filesize = vr->vr_filesize;
+		}
+
+		if (vr->vr_shared) {
+			/*
+			 * Parent and child share the pages of a shared
+			 * mapping, so that each sees the other's writes.
+			 */
+			result = vm_shareregion(old, vr, newas, newvr);
+			if (result) {
+				goto fail;
+			}
+			continue;
+		}
+
+		/*
+		 * Share the pages that exist, copy-on-write; the rest
+		 * stay on-demand. Read-only regions are never written,
+		 * so their pages don't need the COW mark. (Pages out in
+		 * swap share the swap slot; see vm_copypage.)
+		 */
+		for (i = 0; i < vr->vr_npages; i++) {
+			va = vr->vr_base + i * PAGE_SIZE;
+			oldpte = pt_lookup(old->as_pt, va, false);
+			if (oldpte == NULL || *oldpte == 0) {
+				continue;
+			}
+			newpte = pt_lookup(newas->as_pt, va, true);
+			if (newpte == NULL) {
+				result = ENOMEM;
+				goto fail;
+			}
+			result = vm_copypage(oldpte, newpte,
+					     vr->vr_writeable);
+			if (result) {
+				goto fail;
+			}
+		}
+	}
+	lock_release(old->as_lock);
+
 	/*
-	 * Write this.
+	 * The old address space's pages just became read-only; drop
+	 * any writeable mappings of them.
 	 */
-
-	(void)old;
+	vm_tlb_invalidate_all(old);
 
 	*ret = newas;
 	return 0;
+
+ fail:
+	lock_release(old->as_lock);
+	as_destroy(newas);
+	return result;
 }
 
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct vm_region *vr;
 
+	while (as->as_regions != NULL) {
+		vr = as->as_regions;
+		as->as_regions = vr->vr_next;
+		as_freeregion(as, vr);
+	}
+	pt_destroy(as->as_pt);
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -101,18 +342,16 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	/* Switch the TLB over to its address space ID. */
+	vm_tlb_activate(as);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do; the TLB keeps the old address space's
+	 * entries under its own ID, and as_activate switches IDs.
 	 */
 }
 
@@ -122,57 +361,111 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. The
+ * MIPS TLB can only enforce write protection, so READABLE and
+ * EXECUTABLE are ignored.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	size_t npages;
+	int result;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
 	(void)readable;
-	(void)writeable;
 	(void)executable;
-	return ENOSYS;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+	npages = memsize / PAGE_SIZE;
+
+	/* No wrapping around, and no kernel addresses. */
+	if (vaddr + memsize < vaddr || vaddr + memsize > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	lock_acquire(as->as_lock);
+	result = as_addregion(as, vaddr, npages, writeable != 0, NULL);
+	lock_release(as->as_lock);
+	return result;
 }
 
 int
-as_prepare_load(struct addrspace *as)
+as_define_backing(struct addrspace *as, vaddr_t vaddr,
+		  struct vnode *v, off_t offset, size_t filesize)
 {
-	/*
-	 * Write this.
-	 */
+	struct vm_region *vr;
+	vaddr_t top;
+
+	lock_acquire(as->as_lock);
+	vr = as_findregion(as, vaddr);
+	if (vr == NULL || vr->vr_vnode != NULL) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	if (filesize > top - vaddr) {
+		filesize = top - vaddr;
+	}
 
+	VOP_INCREF(v);
+	vr->vr_vnode = v;
+	vr->vr_fileoffset = offset;
+	vr->vr_filevaddr = vaddr;
+	vr->vr_filesize = filesize;
+	lock_release(as->as_lock);
+	return 0;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Nothing is loaded up front. */
 	(void)as;
 	return 0;
 }
 
+/*
+ * Loading is done; put an empty heap after the highest segment.
+ */
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct vm_region *vr;
+	vaddr_t base;
+	int result;
 
-	(void)as;
-	return 0;
+	lock_acquire(as->as_lock);
+	base = 0;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vr->vr_base + vr->vr_npages * PAGE_SIZE > base) {
+			base = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		}
+	}
+	result = as_addregion(as, base, 0, true, &as->as_heap);
+	if (result == 0) {
+		as->as_heapend = base;
+	}
+	lock_release(as->as_lock);
+	return result;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	lock_acquire(as->as_lock);
+	result = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			      VM_STACKPAGES, true, NULL);
+	lock_release(as->as_lock);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +473,325 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct vm_region *vr;
+	vaddr_t newend, top, va;
+	size_t npages;
+	pte_t *pte;
+
+	lock_acquire(as->as_lock);
+	vr = as->as_heap;
+	if (vr == NULL) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+
+	if (amount >= 0) {
+		if ((vaddr_t)amount > USERSPACETOP - as->as_heapend) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+	}
+	else if ((vaddr_t)0 - (vaddr_t)amount > as->as_heapend - vr->vr_base) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+	newend = as->as_heapend + amount;
+	npages = DIVROUNDUP(newend - vr->vr_base, PAGE_SIZE);
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+
+	if (npages > vr->vr_npages) {
+		/* Growing; just don't run into the stack. */
+		if (as_overlaps(as, top, vr->vr_base + npages * PAGE_SIZE,
+				vr)) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+	}
+	else if (npages < vr->vr_npages) {
+		/*
+		 * Shrinking; give back the pages past the new end. Their
+		 * frames can be reused before the shootdown, but only
+		 * this process (i.e., us) could use the stale entries.
+		 */
+		for (va = vr->vr_base + npages * PAGE_SIZE; va < top;
+		     va += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL && *pte != 0) {
+				vm_freepage(pte);
+			}
+		}
+		vm_tlb_shootdown(as, vr->vr_base + npages * PAGE_SIZE,
+				 vr->vr_npages - npages);
+	}
+	vr->vr_npages = npages;
+
+	*oldbreak = as->as_heapend;
+	as->as_heapend = newend;
+	lock_release(as->as_lock);
+	return 0;
+}
+
+/*
+ * Find NPAGES of unused space for a mapping. Mappings go down from
+ * the bottom of the stack, leaving the space above the heap for the
+ * heap to grow into.
+ */
+static
+int
+as_findgap(struct addrspace *as, size_t npages, vaddr_t *ret)
+{
+	struct vm_region *vr;
+	vaddr_t base, top, floor;
+
+	floor = 0;
+	if (as->as_heap != NULL) {
+		floor = as->as_heap->vr_base +
+			as->as_heap->vr_npages * PAGE_SIZE;
+	}
+
+	top = USERSTACK - VM_STACKPAGES * PAGE_SIZE;
+	while (1) {
+		if (top - floor < npages * PAGE_SIZE || top < floor) {
+			return ENOMEM;
+		}
+		base = top - npages * PAGE_SIZE;
+		vr = as_overlaps(as, base, top, NULL);
+		if (vr == NULL) {
+			*ret = base;
+			return 0;
+		}
+		top = vr->vr_base;
+	}
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t vaddr, size_t len, int prot,
+	int flags, struct vnode *v, off_t offset, vaddr_t *ret)
+{
+	struct stat st;
+	struct vm_region *vr;
+	vaddr_t base;
+	size_t npages;
+	off_t filesize;
+	bool shared;
+	int result;
+
+	switch (flags & (MAP_SHARED | MAP_PRIVATE)) {
+	    case MAP_SHARED:
+		shared = true;
+		break;
+	    case MAP_PRIVATE:
+		shared = false;
+		break;
+	    default:
+		return EINVAL;
+	}
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (len > USERSPACETOP) {
+		return ENOMEM;
+	}
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+
+	/* Ask whether the file can be mapped at all. */
+	result = VOP_MMAP(v);
+	if (result) {
+		return result;
+	}
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	/* Past the end of the file, the mapping reads as zeros. */
+	filesize = st.st_size - offset;
+	if (filesize < 0) {
+		filesize = 0;
+	}
+	if (filesize > (off_t)(npages * PAGE_SIZE)) {
+		filesize = npages * PAGE_SIZE;
+	}
+
+	lock_acquire(as->as_lock);
+	if (flags & MAP_FIXED) {
+		if (vaddr % PAGE_SIZE != 0 ||
+		    vaddr + npages * PAGE_SIZE < vaddr ||
+		    vaddr + npages * PAGE_SIZE > USERSPACETOP) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+		base = vaddr;
+	}
+	else {
+		result = as_findgap(as, npages, &base);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+	result = as_addregion(as, base, npages, (prot & PROT_WRITE) != 0,
+			      &vr);
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+	VOP_INCREF(v);
+	vr->vr_mapped = true;
+	vr->vr_shared = shared;
+	vr->vr_vnode = v;
+	vr->vr_fileoffset = offset;
+	vr->vr_filevaddr = base;
+	vr->vr_filesize = filesize;
+	lock_release(as->as_lock);
+
+	*ret = base;
+	return 0;
+}
+
+/*
+ * Find the end of the page range VADDR to VADDR+LEN, checking that
+ * it's a sensible user range.
+ */
+static
+int
+as_pagerange(vaddr_t vaddr, size_t len, vaddr_t *end)
+{
+	if (vaddr % PAGE_SIZE != 0 || len == 0 || len > USERSPACETOP) {
+		return EINVAL;
+	}
+	*end = vaddr + ROUNDUP(len, PAGE_SIZE);
+	if (*end < vaddr || *end > USERSPACETOP) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct vm_region *vr, **vrp, *tail;
+	vaddr_t end, lo, hi, top, va;
+	pte_t *pte;
+	int result;
+
+	result = as_pagerange(vaddr, len, &end);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(as->as_lock);
+
+	/* Only mappings can be unmapped. Save their changes first. */
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (end <= vr->vr_base || top <= vaddr) {
+			continue;
+		}
+		if (!vr->vr_mapped) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+		if (vr->vr_shared) {
+			lo = vaddr > vr->vr_base ? vaddr : vr->vr_base;
+			hi = end < top ? end : top;
+			result = as_syncrange(as, vr, lo, hi);
+			if (result) {
+				lock_release(as->as_lock);
+				return result;
+			}
+		}
+	}
+
+	vrp = &as->as_regions;
+	while ((vr = *vrp) != NULL) {
+		top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (end <= vr->vr_base || top <= vaddr) {
+			vrp = &vr->vr_next;
+			continue;
+		}
+		if (vaddr <= vr->vr_base && top <= end) {
+			/* The whole thing. */
+			*vrp = vr->vr_next;
+			as_freeregion(as, vr);
+			continue;
+		}
+
+		lo = vaddr > vr->vr_base ? vaddr : vr->vr_base;
+		hi = end < top ? end : top;
+		if (vr->vr_base < lo && hi < top) {
+			/* A hole in the middle; split off the top part. */
+			vr->vr_npages = (lo - vr->vr_base) / PAGE_SIZE;
+			result = as_addregion(as, hi, (top - hi) / PAGE_SIZE,
+					      vr->vr_writeable, &tail);
+			if (result) {
+				vr->vr_npages = (top - vr->vr_base) / PAGE_SIZE;
+				lock_release(as->as_lock);
+				return result;
+			}
+			VOP_INCREF(vr->vr_vnode);
+			tail->vr_mapped = true;
+			tail->vr_shared = vr->vr_shared;
+			tail->vr_vnode = vr->vr_vnode;
+			tail->vr_fileoffset = vr->vr_fileoffset;
+			tail->vr_filevaddr = vr->vr_filevaddr;
+			tail->vr_filesize = vr->vr_filesize;
+			tail->vr_object = vr->vr_object;
+			if (tail->vr_object != NULL) {
+				vm_object_incref(tail->vr_object);
+			}
+		}
+		else if (lo == vr->vr_base) {
+			vr->vr_base = hi;
+			vr->vr_npages = (top - hi) / PAGE_SIZE;
+		}
+		else {
+			vr->vr_npages = (lo - vr->vr_base) / PAGE_SIZE;
+		}
+
+		for (va = lo; va < hi; va += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL && *pte != 0) {
+				vm_freepage(pte);
+			}
+		}
+		vrp = &vr->vr_next;
+	}
+
+	/* As for sbrk, only we could have used the stale entries. */
+	vm_tlb_shootdown(as, vaddr, (end - vaddr) / PAGE_SIZE);
+
+	lock_release(as->as_lock);
+	return 0;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct vm_region *vr;
+	vaddr_t end, lo, hi, top;
+	int result, err;
+
+	result = as_pagerange(vaddr, len, &end);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(as->as_lock);
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (end <= vr->vr_base || top <= vaddr || !vr->vr_shared) {
+			continue;
+		}
+		lo = vaddr > vr->vr_base ? vaddr : vr->vr_base;
+		hi = end < top ? end : top;
+		err = as_syncrange(as, vr, lo, hi);
+		if (err && result == 0) {
+			result = err;
+		}
+	}
+	lock_release(as->as_lock);
+	return result;
+}
@@ -0,0 +1,691 @@
+/*
+ * Physical page allocator (coremap).
+ *
+ * Free memory is managed as a binary buddy system: free pages are
+ * kept in blocks of 2^k pages, aligned to their size, on one free
+ * list per order k. Allocating takes a block of the smallest order
+ * that fits, splitting bigger blocks as needed; freeing merges a
+ * block with its buddy (the other half of the next bigger block)
+ * whenever that is free too. Both take O(log n) list operations, and
+ * coalescing keeps large blocks available for multi-page requests
+ * after long runs of allocating and freeing.
+ *
+ * Requests that are not a power of two are rounded up to one and the
+ * unused tail pages go straight back on the free lists, so nothing
+ * is wasted.
+ *
+ * Most user pages start out zeroed. So that the zeroing isn't done
+ * while a process waits in a page fault, idle CPUs fill a small pool
+ * of pages zeroed ahead of time (coremap_zeroidle), which
+ * coremap_alloc_zeroed hands out. Pages in the pool count as
+ * allocated; when the free lists run dry, single-page requests take
+ * them back.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <vm.h>
+#include <coremap.h>
+
+/*
+ * One of these per physical page.
+ *
+ * cm_state says what the page is being used for. For the first page
+ * of an allocated block, cm_npages holds the length of the block so
+ * coremap_free knows how much to release, and cm_refcount the number
+ * of references to it (see coremap_incref); both are 0 on every other
+ * page. (A block is at most 2^BUDDY_MAXORDER pages, so 16 bits is
+ * plenty for the length.) A single user page that may be paged out
+ * has cm_pte pointing at the PTE that maps it; see coremap_clock.
+ * The first page of a free block holds the block's order and
+ * its free list links (as page numbers). cm_tag belongs to whoever
+ * allocated the page (see coremap_settag).
+ */
+struct coremap_entry {
+	uint8_t cm_state;
+	uint8_t cm_order;	/* free block heads: 2^cm_order pages */
+	uint8_t cm_tag;		/* allocated pages: owner's tag */
+	uint8_t cm_flags;	/* pageable pages: CMF_* */
+	uint16_t cm_npages;	/* allocated block heads: length */
+	uint16_t cm_refcount;	/* allocated block heads: references */
+	uint32_t cm_next;	/* free block heads: free list links */
+	uint32_t cm_prev;
+	pte_t *cm_pte;		/* pageable pages: the owner's PTE */
+};
+
+#define CMF_REFERENCED	0x01	/* used since the clock hand last passed */
+
+#define CM_FREE		0	/* first page of a free block */
+#define CM_FREEBODY	1	/* other pages of a free block */
+#define CM_FIXED	2	/* taken before bootstrap; never freed */
+#define CM_ALLOCATED	3	/* handed out by coremap_alloc */
+
+#define CM_NONE		0xffffffff	/* end of free list */
+
+/* Largest block size is 2^BUDDY_MAXORDER pages (4M). */
+#define BUDDY_MAXORDER	10
+
+static struct coremap_entry *coremap;
+static unsigned long coremap_npages;	/* total pages of RAM */
+static unsigned long coremap_nfree;	/* free pages */
+static uint32_t buddy_freelist[BUDDY_MAXORDER + 1];
+static unsigned long coremap_hand;	/* clock hand for coremap_clock */
+
+/*
+ * The pool of zeroed pages, as page numbers. It is only filled while
+ * more than COREMAP_ZERORESERVE pages are free, so it doesn't take
+ * memory that is needed for something else.
+ */
+#define COREMAP_ZEROPAGES	32
+#define COREMAP_ZERORESERVE	(2 * COREMAP_ZEROPAGES)
+static uint32_t coremap_zeroed[COREMAP_ZEROPAGES];
+static unsigned coremap_nzeroed;
+
+/*
+ * Protects the coremap, and ram_stealmem before the coremap is set
+ * up. A spinlock, because the allocator never needs to sleep and is
+ * called from places (e.g. kmalloc) that must not.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Free list operations.
+ */
+static
+void
+buddy_push(unsigned long index, unsigned order)
+{
+	uint32_t head = buddy_freelist[order];
+
+	coremap[index].cm_state = CM_FREE;
+	coremap[index].cm_order = order;
+	coremap[index].cm_prev = CM_NONE;
+	coremap[index].cm_next = head;
+	if (head != CM_NONE) {
+		coremap[head].cm_prev = index;
+	}
+	buddy_freelist[order] = index;
+}
+
+static
+void
+buddy_unlink(unsigned long index)
+{
+	struct coremap_entry *e = &coremap[index];
+
+	KASSERT(e->cm_state == CM_FREE);
+	if (e->cm_prev != CM_NONE) {
+		coremap[e->cm_prev].cm_next = e->cm_next;
+	}
+	else {
+		KASSERT(buddy_freelist[e->cm_order] == index);
+		buddy_freelist[e->cm_order] = e->cm_next;
+	}
+	if (e->cm_next != CM_NONE) {
+		coremap[e->cm_next].cm_prev = e->cm_prev;
+	}
+	e->cm_state = CM_FREEBODY;
+}
+
+/*
+ * Free the block of 2^ORDER pages at INDEX, merging it with its buddy
+ * as far up as possible. The pages themselves must already be marked
+ * CM_FREEBODY.
+ */
+static
+void
+buddy_freeblock(unsigned long index, unsigned order)
+{
+	unsigned long buddy;
+
+	while (order < BUDDY_MAXORDER) {
+		buddy = index ^ (1UL << order);
+		if (buddy >= coremap_npages ||
+		    coremap[buddy].cm_state != CM_FREE ||
+		    coremap[buddy].cm_order != order) {
+			break;
+		}
+		buddy_unlink(buddy);
+		if (buddy < index) {
+			index = buddy;
+		}
+		order++;
+	}
+	buddy_push(index, order);
+}
+
+/*
+ * Free the NPAGES pages starting at INDEX, as a series of aligned
+ * power-of-two blocks. INDEX must be aligned to the largest of them,
+ * which is always true for a block that came from buddy_alloc, and
+ * the pages must already be marked CM_FREEBODY.
+ */
+static
+void
+buddy_freerange(unsigned long index, unsigned long npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order < BUDDY_MAXORDER &&
+		       (index & ((2UL << order) - 1)) == 0 &&
+		       (2UL << order) <= npages) {
+			order++;
+		}
+		buddy_freeblock(index, order);
+		index += 1UL << order;
+		npages -= 1UL << order;
+	}
+}
+
+/*
+ * Set up the coremap. The table itself goes in memory stolen from
+ * ram_stealmem; after that, all pages below ram_getfirstfree() are
+ * fixed and the rest are free.
+ */
+void
+coremap_bootstrap(void)
+{
+	unsigned long npages, tablepages, firstfree, i;
+	paddr_t tablepaddr;
+
+	KASSERT(coremap == NULL);
+
+	npages = ram_getsize() / PAGE_SIZE;
+	tablepages = DIVROUNDUP(npages * sizeof(struct coremap_entry),
+				PAGE_SIZE);
+
+	spinlock_acquire(&coremap_lock);
+
+	tablepaddr = ram_stealmem(tablepages);
+	if (tablepaddr == 0) {
+		panic("coremap: Cannot allocate coremap\n");
+	}
+	firstfree = ram_getfirstfree() / PAGE_SIZE;
+	KASSERT(firstfree <= npages);
+
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(tablepaddr);
+	coremap_npages = npages;
+	for (i=0; i<=BUDDY_MAXORDER; i++) {
+		buddy_freelist[i] = CM_NONE;
+	}
+	for (i=0; i<npages; i++) {
+		coremap[i].cm_state = i < firstfree ? CM_FIXED : CM_FREEBODY;
+		coremap[i].cm_order = 0;
+		coremap[i].cm_tag = 0;
+		coremap[i].cm_flags = 0;
+		coremap[i].cm_npages = 0;
+		coremap[i].cm_refcount = 0;
+		coremap[i].cm_pte = NULL;
+		coremap[i].cm_next = coremap[i].cm_prev = CM_NONE;
+	}
+	for (i=firstfree; i<npages; i++) {
+		buddy_freeblock(i, 0);
+	}
+	coremap_nfree = npages - firstfree;
+
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %lu pages, %lu free\n", npages, coremap_nfree);
+}
+
+/*
+ * Take a block of 2^ORDER pages off the free lists, splitting a
+ * bigger one if necessary. Returns CM_NONE if there is none.
+ */
+static
+uint32_t
+buddy_alloc(unsigned order)
+{
+	unsigned k;
+	uint32_t index;
+
+	for (k=order; k<=BUDDY_MAXORDER; k++) {
+		if (buddy_freelist[k] != CM_NONE) {
+			break;
+		}
+	}
+	if (k > BUDDY_MAXORDER) {
+		return CM_NONE;
+	}
+
+	index = buddy_freelist[k];
+	buddy_unlink(index);
+
+	/* Split, giving back the upper half each time. */
+	while (k > order) {
+		k--;
+		buddy_push(index + (1UL << k), k);
+	}
+	return index;
+}
+
+/*
+ * Allocate NPAGES contiguous pages.
+ */
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	unsigned long i;
+	unsigned order;
+	uint32_t base;
+	paddr_t pa;
+
+	KASSERT(npages > 0);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (coremap == NULL) {
+		/* Too early; no way to give these back. */
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (npages > coremap_nfree || order > BUDDY_MAXORDER) {
+		pa = 0;
+		if (npages == 1 && coremap_nzeroed > 0) {
+			/* Out of free pages; raid the zeroed pool. */
+			coremap_nzeroed--;
+			pa = (paddr_t)coremap_zeroed[coremap_nzeroed] *
+				PAGE_SIZE;
+		}
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	base = buddy_alloc(order);
+	if (base == CM_NONE) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	/* Give back what we don't need. */
+	buddy_freerange(base + npages, (1UL << order) - npages);
+
+	for (i=0; i<npages; i++) {
+		KASSERT(coremap[base + i].cm_state == CM_FREEBODY);
+		coremap[base + i].cm_state = CM_ALLOCATED;
+		coremap[base + i].cm_tag = 0;
+		coremap[base + i].cm_flags = 0;
+		coremap[base + i].cm_npages = 0;
+		coremap[base + i].cm_pte = NULL;
+	}
+	coremap[base].cm_npages = npages;
+	coremap[base].cm_refcount = 1;
+	coremap_nfree -= npages;
+
+	spinlock_release(&coremap_lock);
+
+	return (paddr_t)base * PAGE_SIZE;
+}
+
+/*
+ * Allocate one page, filled with zeros.
+ */
+paddr_t
+coremap_alloc_zeroed(void)
+{
+	paddr_t pa;
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap_nzeroed > 0) {
+		coremap_nzeroed--;
+		pa = (paddr_t)coremap_zeroed[coremap_nzeroed] * PAGE_SIZE;
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+	spinlock_release(&coremap_lock);
+
+	pa = coremap_alloc(1);
+	if (pa != 0) {
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	return pa;
+}
+
+/*
+ * Zero one page for the pool, if it wants one. Called by idle CPUs
+ * (see thread_switch); returns true if it did anything, so the
+ * caller can check for work again before calling it some more.
+ */
+bool
+coremap_zeroidle(void)
+{
+	paddr_t pa;
+	bool want;
+
+	spinlock_acquire(&coremap_lock);
+	want = coremap != NULL && coremap_nzeroed < COREMAP_ZEROPAGES &&
+		coremap_nfree > COREMAP_ZERORESERVE;
+	spinlock_release(&coremap_lock);
+	if (!want) {
+		return false;
+	}
+
+	pa = coremap_alloc(1);
+	if (pa == 0) {
+		return false;
+	}
+	bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap_nzeroed < COREMAP_ZEROPAGES) {
+		coremap_zeroed[coremap_nzeroed++] = pa / PAGE_SIZE;
+		pa = 0;
+	}
+	spinlock_release(&coremap_lock);
+
+	if (pa != 0) {
+		/* Another CPU filled it first. */
+		coremap_free(pa);
+	}
+	return true;
+}
+
+/*
+ * Drop a reference to the block beginning at PADDR, and free it if
+ * that was the last one.
+ */
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned long base, npages, i;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+
+	spinlock_acquire(&coremap_lock);
+
+	base = paddr / PAGE_SIZE;
+	if (coremap == NULL) {
+		/* Stolen before bootstrap; leak it. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	KASSERT(base < coremap_npages);
+	if (coremap[base].cm_state == CM_FIXED) {
+		/* Stolen before bootstrap; leak it. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+	KASSERT(coremap[base].cm_state == CM_ALLOCATED);
+	npages = coremap[base].cm_npages;
+	KASSERT(npages > 0);
+
+	KASSERT(coremap[base].cm_refcount > 0);
+	if (--coremap[base].cm_refcount > 0) {
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	for (i=0; i<npages; i++) {
+		KASSERT(coremap[base + i].cm_state == CM_ALLOCATED);
+		KASSERT(i == 0 || coremap[base + i].cm_npages == 0);
+		coremap[base + i].cm_state = CM_FREEBODY;
+		coremap[base + i].cm_tag = 0;
+		coremap[base + i].cm_flags = 0;
+		coremap[base + i].cm_npages = 0;
+		coremap[base + i].cm_pte = NULL;
+	}
+	buddy_freerange(base, npages);
+	coremap_nfree += npages;
+
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Add a reference to the block beginning at PADDR, for sharing it
+ * (e.g. copy-on-write). Each reference is dropped with coremap_free.
+ */
+void
+coremap_incref(paddr_t paddr)
+{
+	unsigned long index = paddr / PAGE_SIZE;
+
+	KASSERT(coremap != NULL);
+	KASSERT(index < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[index].cm_state == CM_ALLOCATED);
+	KASSERT(coremap[index].cm_npages > 0);
+	KASSERT(coremap[index].cm_refcount < 0xffff);
+	coremap[index].cm_refcount++;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of references to the block at PADDR. This is
+ * only a snapshot unless the caller holds all of them but one.
+ */
+unsigned
+coremap_getref(paddr_t paddr)
+{
+	unsigned long index = paddr / PAGE_SIZE;
+
+	KASSERT(coremap != NULL);
+	KASSERT(index < coremap_npages);
+	return coremap[index].cm_refcount;
+}
+
+/*
+ * Return the number of pages that can be allocated without evicting
+ * anything: the free pages and the zeroed pool. Only a snapshot.
+ */
+unsigned long
+coremap_nfreepages(void)
+{
+	unsigned long n;
+
+	spinlock_acquire(&coremap_lock);
+	n = coremap_nfree + coremap_nzeroed;
+	spinlock_release(&coremap_lock);
+	return n;
+}
+
+/*
+ * Say that the single page at PADDR is a user page mapped only by
+ * *PTE and can be paged out, or with PTE NULL that it can't (e.g.
+ * because it is shared). The page counts as recently used.
+ *
+ * The caller must hold the VM system's page lock (see vm.c), which
+ * also covers the PTE_BUSY bit in *PTE.
+ */
+void
+coremap_setpte(paddr_t paddr, pte_t *pte)
+{
+	unsigned long index = paddr / PAGE_SIZE;
+
+	KASSERT(coremap != NULL);
+	KASSERT(index < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[index].cm_state == CM_ALLOCATED);
+	KASSERT(coremap[index].cm_npages == 1);
+	coremap[index].cm_pte = pte;
+	coremap[index].cm_flags |= CMF_REFERENCED;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Note that the page at PADDR has just been used.
+ */
+void
+coremap_touch(paddr_t paddr)
+{
+	unsigned long index = paddr / PAGE_SIZE;
+
+	KASSERT(coremap != NULL);
+	KASSERT(index < coremap_npages);
+
+	/* Just a hint; a racing update doesn't matter. */
+	coremap[index].cm_flags |= CMF_REFERENCED;
+}
+
+/*
+ * Choose a page to evict, by the clock (second-chance) algorithm:
+ * sweep the hand over the pageable pages, clearing the referenced
+ * flag on each, and take the first one found with it already clear.
+ * Pages that are shared or busy are skipped. Returns the page and
+ * sets *PTERET to its PTE, or returns 0 if nothing can be evicted.
+ *
+ * The caller must hold the VM system's page lock, so the PTE_BUSY
+ * bits are stable; it is expected to mark the PTE busy before
+ * dropping the lock.
+ */
+paddr_t
+coremap_clock(pte_t **pteret)
+{
+	unsigned long n, index;
+	struct coremap_entry *e;
+
+	KASSERT(coremap != NULL);
+
+	spinlock_acquire(&coremap_lock);
+	/* Two full turns: the first may only clear referenced flags. */
+	for (n = 0; n < 2 * coremap_npages; n++) {
+		index = coremap_hand;
+		coremap_hand = (coremap_hand + 1) % coremap_npages;
+
+		e = &coremap[index];
+		if (e->cm_state != CM_ALLOCATED || e->cm_pte == NULL ||
+		    e->cm_refcount != 1 || (*e->cm_pte & PTE_BUSY)) {
+			continue;
+		}
+		if (e->cm_flags & CMF_REFERENCED) {
+			e->cm_flags &= ~CMF_REFERENCED;
+			continue;
+		}
+		*pteret = e->cm_pte;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)index * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+/*
+ * Set and get the tag of an allocated page. The tag is a byte the
+ * page's owner can use to remember what the page is for; it starts
+ * out 0 and is cleared again when the page is freed. Pages that were
+ * stolen before the coremap was set up can't be tagged and always
+ * read as 0.
+ *
+ * The tag can be read without locking as long as the caller knows
+ * the page stays allocated while it looks.
+ */
+void
+coremap_settag(paddr_t paddr, unsigned tag)
+{
+	unsigned long index = paddr / PAGE_SIZE;
+
+	KASSERT(tag <= 0xff);
+	if (coremap == NULL) {
+		return;
+	}
+	KASSERT(index < coremap_npages);
+	if (coremap[index].cm_state == CM_FIXED) {
+		/* Stolen before bootstrap; can't be tagged. */
+		return;
+	}
+	KASSERT(coremap[index].cm_state == CM_ALLOCATED);
+	coremap[index].cm_tag = tag;
+}
+
+unsigned
+coremap_gettag(paddr_t paddr)
+{
+	unsigned long index = paddr / PAGE_SIZE;
+
+	if (coremap == NULL || index >= coremap_npages) {
+		return 0;
+	}
+	return coremap[index].cm_tag;
+}
+
+/*
+ * Print page counts, and the number of free blocks of each size.
+ */
+void
+coremap_printstats(void)
+{
+	unsigned long i, nfixed, nalloc, nblocks;
+	unsigned order;
+	uint32_t index;
+
+	nfixed = nalloc = 0;
+
+	spinlock_acquire(&coremap_lock);
+	for (i=0; i<coremap_npages; i++) {
+		switch (coremap[i].cm_state) {
+		    case CM_FIXED:
+			nfixed++;
+			break;
+		    case CM_ALLOCATED:
+			nalloc++;
+			break;
+		}
+	}
+	kprintf("coremap: %lu pages: %lu fixed, %lu allocated, %lu free\n",
+		coremap_npages, nfixed, nalloc, coremap_nfree);
+	kprintf("coremap: %u zeroed pages ready\n", coremap_nzeroed);
+	kprintf("coremap: free blocks by order:");
+	for (order=0; order<=BUDDY_MAXORDER; order++) {
+		nblocks = 0;
+		for (index = buddy_freelist[order]; index != CM_NONE;
+		     index = coremap[index].cm_next) {
+			nblocks++;
+		}
+		kprintf(" %lu", nblocks);
+	}
+	kprintf("\n");
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Allocate/free some kernel-space virtual pages. Kernel pages are
+ * reached through the direct-mapped kseg0 window, so these are just
+ * physical allocations.
+ *
+ * When memory is full of user pages, a caller that can sleep gets
+ * user pages pushed out to make room (see vm_reclaimpage), one at a
+ * time until the allocation fits or there is nothing left to push.
+ * One that can't (it holds a spinlock, or is an interrupt handler)
+ * just gets 0.
+ */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	while ((pa = coremap_alloc(npages)) == 0) {
+		if (npages > (1UL << BUDDY_MAXORDER)) {
+			/* Too big to ever fit. */
+			return 0;
+		}
+		if (!CURCPU_EXISTS() || curcpu->c_spinlocks > 0 ||
+		    curthread->t_in_interrupt) {
+			return 0;
+		}
+		if (!vm_reclaimpage()) {
+			return 0;
+		}
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	KASSERT(addr >= MIPS_KSEG0);
+	coremap_free(addr - MIPS_KSEG0);
+}
@@ -29,8 +29,12 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <coremap.h>
 
 /*
  * Kernel malloc.
@@ -160,10 +164,9 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the whole thing. Most subpage allocations and
+ * frees don't get this far, though; they are served from per-cpu
+ * magazines (see below), which only come here in batches.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -866,6 +869,45 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+/*
+ * Take a block off the free list of the page PR, which must have at
+ * least one.
+ */
+static
+void *
+subpage_takeblock(struct pageref *pr)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+
+	return retptr;
+}
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -921,25 +963,7 @@ subpage_kmalloc(size_t sz
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+			retptr = subpage_takeblock(pr);
 #ifdef GUARDS
 			retptr = establishguardband(retptr, clientsz, sz);
 #endif
@@ -989,6 +1013,9 @@ subpage_kmalloc(size_t sz
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
 
+	/* Record the block size in the coremap, for kfree's fast path. */
+	coremap_settag(prpage - MIPS_KSEG0, blktype + 1);
+
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
 	 * using in spring 2001 attempted to optimize this loop and
@@ -1018,56 +1045,18 @@ subpage_kmalloc(size_t sz
 }
 
 /*
- * Free a pointer previously returned from subpage_kmalloc. If the
- * pointer is not on any heap page we recognize, return -1.
+ * Find the heap page that PTRADDR is on. Returns NULL if it isn't on
+ * any of them.
  */
 static
-int
-subpage_kfree(void *ptr)
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
 {
-	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
-#ifdef GUARDS
-	size_t blocksize, smallerblocksize;
-#endif
-
-	ptraddr = (vaddr_t)ptr;
-#ifdef GUARDS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/*
-		 * With guard bands, all client-facing subpage
-		 * pointers are offset by GUARD_PTROFFSET (which is 4)
-		 * from the underlying blocks and are therefore not
-		 * page-aligned. So a page-aligned pointer is not one
-		 * of ours. Catch this up front, as otherwise
-		 * subtracting GUARD_PTROFFSET could give a pointer on
-		 * a page we *do* own, and then we'll panic because
-		 * it's not a valid one.
-		 */
-		return -1;
-	}
-	ptraddr -= GUARD_PTROFFSET;
-#endif
-#ifdef LABELS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/* ditto */
-		return -1;
-	}
-	ptraddr -= LABEL_PTROFFSET;
-#endif
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
+	int blktype;		// index into sizes[] that we're using
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	for (pr = allbase; pr; pr = pr->next_all) {
 		prpage = PR_PAGEADDR(pr);
@@ -1079,16 +1068,36 @@ subpage_kfree(void *ptr)
 		checksubpage(pr);
 
 		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+			return pr;
 		}
 	}
+	return NULL;
+}
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
+/*
+ * Put the block at PTRADDR (for client pointer PTR) back on the free
+ * list of its page PR. If that makes the whole page free, take the
+ * page off the lists and return its address; the caller should free
+ * it with free_kpages after releasing kmalloc_spinlock. Otherwise
+ * return 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr, void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+#ifdef GUARDS
+	size_t blocksize, smallerblocksize;
+#endif
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1142,12 +1151,65 @@ subpage_kfree(void *ptr)
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+		return prpage;
 	}
-	else {
+	return 0;
+}
+
+/*
+ * Free a pointer previously returned from subpage_kmalloc. If the
+ * pointer is not on any heap page we recognize, return -1.
+ */
+static
+int
+subpage_kfree(void *ptr)
+{
+	vaddr_t ptraddr;	// same as ptr
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// page to release, if any
+
+	ptraddr = (vaddr_t)ptr;
+#ifdef GUARDS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/*
+		 * With guard bands, all client-facing subpage
+		 * pointers are offset by GUARD_PTROFFSET (which is 4)
+		 * from the underlying blocks and are therefore not
+		 * page-aligned. So a page-aligned pointer is not one
+		 * of ours. Catch this up front, as otherwise
+		 * subtracting GUARD_PTROFFSET could give a pointer on
+		 * a page we *do* own, and then we'll panic because
+		 * it's not a valid one.
+		 */
+		return -1;
+	}
+	ptraddr -= GUARD_PTROFFSET;
+#endif
+#ifdef LABELS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/* ditto */
+		return -1;
+	}
+	ptraddr -= LABEL_PTROFFSET;
+#endif
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	pr = subpage_findpage(ptraddr);
+	if (pr==NULL) {
+		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
+		return -1;
+	}
+
+	prpage = subpage_putblock(pr, ptraddr, ptr);
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+	if (prpage != 0) {
+		free_kpages(prpage);
 	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
@@ -1159,6 +1221,211 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Per-cpu magazines.
+//
+// Each cpu keeps, for each block size, a magazine: a small stack of
+// free blocks. kmalloc pops a block off the current cpu's magazine
+// and kfree pushes one on, with only interrupts disabled and no
+// shared lock. When a magazine runs empty it is refilled with
+// MAG_BATCH blocks from the heap pages above, under kmalloc_spinlock;
+// when it fills up, its MAG_BATCH oldest (and least likely to still
+// be in the cache) blocks go back the same way.
+//
+// kfree needs the block size without searching the heap pages; the
+// subpage allocator records it in the coremap tag of each heap page
+// (as the block type plus one, so 0 means "not a heap page"). Heap
+// pages allocated before the coremap existed have no tag, so blocks
+// on them always take the slow path.
+//
+// The debugging modes that change the block layout (GUARDS, LABELS)
+// need every allocation to go through subpage_kmalloc, so magazines
+// are disabled with them.
+//
+
+#if !defined(GUARDS) && !defined(LABELS)
+#define MAGAZINES
+#endif
+
+#ifdef MAGAZINES
+
+#define MAG_ROUNDS	16	/* blocks per magazine */
+#define MAG_BATCH	8	/* blocks per refill or flush */
+
+/* System/161 has at most 32 cpus; any beyond that use the slow path. */
+#define MAG_MAXCPUS	32
+
+struct magazine {
+	unsigned nrounds;
+	void *rounds[MAG_ROUNDS];
+};
+
+static struct magazine magazines[MAG_MAXCPUS][NSIZES];
+
+/*
+ * Get the current cpu's magazine for BLKTYPE, or NULL if there isn't
+ * one. Interrupts must be off, so we stay on this cpu.
+ */
+static
+struct magazine *
+mag_get(unsigned blktype)
+{
+	KASSERT(curthread == NULL || curthread->t_iplhigh_count > 0);
+
+	if (!CURCPU_EXISTS() || curcpu->c_number >= MAG_MAXCPUS) {
+		return NULL;
+	}
+	return &magazines[curcpu->c_number][blktype];
+}
+
+/*
+ * Move up to MAG_BATCH blocks from the heap pages into MAG.
+ */
+static
+void
+mag_refill(struct magazine *mag, unsigned blktype)
+{
+	struct pageref *pr;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	for (pr = sizebases[blktype];
+	     pr != NULL && mag->nrounds < MAG_BATCH;
+	     pr = pr->next_samesize) {
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		while (pr->nfree > 0 && mag->nrounds < MAG_BATCH) {
+			mag->rounds[mag->nrounds++] = subpage_takeblock(pr);
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Move the MAG_BATCH oldest blocks in MAG back to the heap pages.
+ */
+static
+void
+mag_flush(struct magazine *mag)
+{
+	vaddr_t freepages[MAG_BATCH];
+	unsigned i, nfreepages;
+	struct pageref *pr;
+	vaddr_t ptraddr;
+
+	KASSERT(mag->nrounds >= MAG_BATCH);
+
+	nfreepages = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<MAG_BATCH; i++) {
+		ptraddr = (vaddr_t)mag->rounds[i];
+		pr = subpage_findpage(ptraddr);
+		KASSERT(pr != NULL);
+		freepages[nfreepages] = subpage_putblock(pr, ptraddr,
+							 mag->rounds[i]);
+		if (freepages[nfreepages] != 0) {
+			nfreepages++;
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	for (i=MAG_BATCH; i<mag->nrounds; i++) {
+		mag->rounds[i - MAG_BATCH] = mag->rounds[i];
+	}
+	mag->nrounds -= MAG_BATCH;
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+}
+
+/*
+ * Allocate a block of size SZ from the current cpu's magazine.
+ * Returns NULL if none could be had without making a new heap page;
+ * the caller should then use subpage_kmalloc.
+ */
+static
+void *
+mag_kmalloc(size_t sz)
+{
+	struct magazine *mag;
+	unsigned blktype;
+	void *ptr;
+	int spl;
+
+	blktype = blocktype(sz);
+
+	spl = splhigh();
+	mag = mag_get(blktype);
+	if (mag == NULL) {
+		splx(spl);
+		return NULL;
+	}
+	if (mag->nrounds == 0) {
+		mag_refill(mag, blktype);
+	}
+	ptr = mag->nrounds > 0 ? mag->rounds[--mag->nrounds] : NULL;
+	splx(spl);
+
+	return ptr;
+}
+
+/*
+ * Free PTR into the current cpu's magazine. Returns -1 if it is not
+ * a block on a tagged heap page; the caller should then use
+ * subpage_kfree.
+ */
+static
+int
+mag_kfree(void *ptr)
+{
+	struct magazine *mag;
+	vaddr_t ptraddr;
+	unsigned tag, blktype;
+	int spl;
+
+	ptraddr = (vaddr_t)ptr;
+	if (ptraddr < MIPS_KSEG0) {
+		return -1;
+	}
+	tag = coremap_gettag((ptraddr & PAGE_FRAME) - MIPS_KSEG0);
+	if (tag == 0) {
+		return -1;
+	}
+	blktype = tag - 1;
+	KASSERT(blktype < NSIZES);
+
+	/* Check for proper alignment */
+	if ((ptraddr & ~(vaddr_t)PAGE_FRAME) % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef(ptr, sizes[blktype]);
+
+	spl = splhigh();
+	mag = mag_get(blktype);
+	if (mag == NULL) {
+		splx(spl);
+		return -1;
+	}
+	if (mag->nrounds == MAG_ROUNDS) {
+		mag_flush(mag);
+	}
+	KASSERT(mag->nrounds < MAG_ROUNDS);
+	mag->rounds[mag->nrounds++] = ptr;
+	splx(spl);
+
+	return 0;
+}
+
+#endif /* MAGAZINES */
+
 //
 ////////////////////////////////////////////////////////////
 
@@ -1198,6 +1465,17 @@ kmalloc(size_t sz)
 		return (void *)address;
 	}
 
+#ifdef MAGAZINES
+	{
+		void *ptr;
+
+		ptr = mag_kmalloc(sz);
+		if (ptr != NULL) {
+			return ptr;
+		}
+	}
+#endif
+
 #ifdef LABELS
 	return subpage_kmalloc(sz, label);
 #else
@@ -1216,7 +1494,13 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#ifdef MAGAZINES
+	if (mag_kfree(ptr) == 0) {
+		return;
+	}
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
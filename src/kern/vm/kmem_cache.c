@@ -0,0 +1,199 @@
+/*
+ * Object caches.
+ *
+ * Each cache keeps a small stack of free, constructed objects. An
+ * allocation pops one if there is one and otherwise falls back to
+ * kmalloc plus the constructor; a free pushes the object back unless
+ * the stack is full, in which case the object is destructed and
+ * kfree'd. The stack is LIFO so the object handed out is the one
+ * most recently touched and most likely still in the cache.
+ *
+ * The underlying memory comes from kmalloc, so the cache adds no
+ * fragmentation of its own and needs no page management; what it
+ * saves is the kmalloc/kfree round trip and, more importantly, the
+ * constructor/destructor work (creating locks and the like) on every
+ * use.
+ *
+ * All caches are on one list, so that when memory runs out the VM
+ * system can have every cache give its free objects back (see
+ * kmem_cache_reclaim).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmem_cache.h>
+
+/* Number of free objects each cache holds on to. */
+#define KMEM_CACHE_DEPTH	32
+
+struct kmem_cache {
+	struct kmem_cache *kc_next;	/* on kmem_caches */
+	char *kc_name;
+	size_t kc_objsize;
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+	struct spinlock kc_lock;	/* protects the fields below */
+	unsigned kc_nfree;
+	void *kc_free[KMEM_CACHE_DEPTH];
+};
+
+/* All caches, for kmem_cache_reclaim. */
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t objsize,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(objsize > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = kstrdup(name);
+	if (kc->kc_name == NULL) {
+		kfree(kc);
+		return NULL;
+	}
+	kc->kc_objsize = objsize;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_nfree = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+	return kc;
+}
+
+/*
+ * Really get rid of an object.
+ */
+static
+void
+kmem_cache_release(struct kmem_cache *kc, void *obj)
+{
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	unsigned i;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+		KASSERT(*kcp != NULL);
+	}
+	*kcp = kc->kc_next;
+	spinlock_release(&kmem_caches_lock);
+
+	/*
+	 * Nobody else may be using the cache any more, so the objects
+	 * can be destructed without holding the spinlock (which the
+	 * destructor might not tolerate).
+	 */
+	for (i = 0; i < kc->kc_nfree; i++) {
+		kmem_cache_release(kc, kc->kc_free[i]);
+	}
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc->kc_name);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_nfree > 0) {
+		obj = kc->kc_free[--kc->kc_nfree];
+		spinlock_release(&kc->kc_lock);
+		return obj;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	obj = kmalloc(kc->kc_objsize);
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL && kc->kc_ctor(obj)) {
+		kfree(obj);
+		return NULL;
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	KASSERT(obj != NULL);
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_nfree < KMEM_CACHE_DEPTH) {
+		kc->kc_free[kc->kc_nfree++] = obj;
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	kmem_cache_release(kc, obj);
+}
+
+/*
+ * Empty the caches one at a time. A cache's free objects are taken
+ * off it while the list lock keeps it from being destroyed, then
+ * released with no locks held, as in kmem_cache_destroy.
+ */
+bool
+kmem_cache_reclaim(void)
+{
+	struct kmem_cache *kc;
+	void *objs[KMEM_CACHE_DEPTH];
+	void (*dtor)(void *obj);
+	unsigned i, n;
+	bool freed;
+
+	freed = false;
+	while (1) {
+		n = 0;
+		dtor = NULL;
+		spinlock_acquire(&kmem_caches_lock);
+		for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+			spinlock_acquire(&kc->kc_lock);
+			n = kc->kc_nfree;
+			for (i = 0; i < n; i++) {
+				objs[i] = kc->kc_free[i];
+			}
+			kc->kc_nfree = 0;
+			dtor = kc->kc_dtor;
+			spinlock_release(&kc->kc_lock);
+			if (n > 0) {
+				break;
+			}
+		}
+		spinlock_release(&kmem_caches_lock);
+
+		if (n == 0) {
+			return freed;
+		}
+		for (i = 0; i < n; i++) {
+			if (dtor != NULL) {
+				dtor(objs[i]);
+			}
+			kfree(objs[i]);
+		}
+		freed = true;
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * Two-level page tables. See pagetable.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+#define PT_ENTRIES	1024			/* entries per level */
+#define PT_DIRINDEX(va)	((va) >> 22)
+#define PT_TABINDEX(va)	(((va) >> 12) & (PT_ENTRIES - 1))
+
+struct pagetable {
+	pte_t *pt_dir[PT_ENTRIES];
+};
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	bzero(pt, sizeof(*pt));
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	for (i = 0; i < PT_ENTRIES; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *table;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	table = pt->pt_dir[PT_DIRINDEX(vaddr)];
+	if (table == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		table = kmalloc(PT_ENTRIES * sizeof(pte_t));
+		if (table == NULL) {
+			return NULL;
+		}
+		bzero(table, PT_ENTRIES * sizeof(pte_t));
+		pt->pt_dir[PT_DIRINDEX(vaddr)] = table;
+	}
+	return &table[PT_TABINDEX(vaddr)];
+}
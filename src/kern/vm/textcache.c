@@ -0,0 +1,189 @@
+/*
+ * Shared read-only program pages. See textcache.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <textcache.h>
+
+/*
+ * Entries are hashed on their key into TEXTCACHE_BUCKETS chains.
+ * Like the ELF header cache, an entry holds no reference to its
+ * vnode. Instead the vnode has vn_textcached set while it may have
+ * entries, and when it changes or goes away it has them dropped with
+ * textcache_purge, since they could never match again.
+ *
+ * textcache_lock protects the chains. Lookup adds its reference to
+ * the frame while holding it, which is what lets reclaim trust a
+ * reference count of 1: the only other way a cached frame gains a
+ * reference is fork sharing a page some process already maps.
+ */
+#define TEXTCACHE_BUCKETS	64
+
+struct textcache_entry {
+	struct textcache_entry *te_next;
+	struct vnode *te_vnode;
+	unsigned te_version;
+	off_t te_offset;
+	paddr_t te_frame;
+};
+
+static struct spinlock textcache_lock = SPINLOCK_INITIALIZER;
+static struct textcache_entry *textcache[TEXTCACHE_BUCKETS];
+static unsigned textcache_hand;		/* next bucket for reclaim */
+
+static
+unsigned
+textcache_hash(struct vnode *v, unsigned version, off_t offset)
+{
+	uint32_t h;
+
+	h = (uint32_t)(uintptr_t)v >> 4;
+	h ^= version * 0x9e3779b1;
+	h ^= (uint32_t)(offset / PAGE_SIZE) * 0x85ebca6b;
+	return (h >> 16 ^ h) % TEXTCACHE_BUCKETS;
+}
+
+/*
+ * Find the entry for the given key. Call with textcache_lock held.
+ */
+static
+struct textcache_entry *
+textcache_find(struct vnode *v, unsigned version, off_t offset)
+{
+	struct textcache_entry *te;
+
+	te = textcache[textcache_hash(v, version, offset)];
+	for (; te != NULL; te = te->te_next) {
+		if (te->te_vnode == v && te->te_version == version &&
+		    te->te_offset == offset) {
+			return te;
+		}
+	}
+	return NULL;
+}
+
+paddr_t
+textcache_lookup(struct vnode *v, off_t offset)
+{
+	struct textcache_entry *te;
+	paddr_t pa;
+
+	pa = 0;
+	spinlock_acquire(&textcache_lock);
+	te = textcache_find(v, v->vn_version, offset);
+	if (te != NULL) {
+		pa = te->te_frame;
+		coremap_incref(pa);
+	}
+	spinlock_release(&textcache_lock);
+	return pa;
+}
+
+bool
+textcache_insert(struct vnode *v, unsigned version, off_t offset,
+		 paddr_t *pa)
+{
+	struct textcache_entry *te, *newte;
+	unsigned bucket;
+
+	/* Allocate first; kmalloc can't be called with a spinlock. */
+	newte = kmalloc(sizeof(*newte));
+	if (newte == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&textcache_lock);
+	te = textcache_find(v, version, offset);
+	if (te != NULL) {
+		/* Someone else read it in meanwhile; use theirs. */
+		coremap_incref(te->te_frame);
+		spinlock_release(&textcache_lock);
+		kfree(newte);
+		coremap_free(*pa);
+		*pa = te->te_frame;
+		return true;
+	}
+
+	spinlock_acquire(&v->vn_countlock);
+	v->vn_textcached = true;
+	spinlock_release(&v->vn_countlock);
+
+	newte->te_vnode = v;
+	newte->te_version = version;
+	newte->te_offset = offset;
+	newte->te_frame = *pa;
+	coremap_incref(*pa);
+	bucket = textcache_hash(v, version, offset);
+	newte->te_next = textcache[bucket];
+	textcache[bucket] = newte;
+	spinlock_release(&textcache_lock);
+	return true;
+}
+
+/*
+ * Sweep the buckets from where the last call left off, and drop the
+ * first entry whose frame has no users but us.
+ */
+bool
+textcache_reclaim(void)
+{
+	struct textcache_entry *te, **tep;
+	unsigned n, bucket;
+
+	spinlock_acquire(&textcache_lock);
+	for (n = 0; n < TEXTCACHE_BUCKETS; n++) {
+		bucket = textcache_hand;
+		textcache_hand = (textcache_hand + 1) % TEXTCACHE_BUCKETS;
+		for (tep = &textcache[bucket]; *tep != NULL;
+		     tep = &(*tep)->te_next) {
+			te = *tep;
+			if (coremap_getref(te->te_frame) == 1) {
+				*tep = te->te_next;
+				spinlock_release(&textcache_lock);
+				coremap_free(te->te_frame);
+				kfree(te);
+				return true;
+			}
+		}
+	}
+	spinlock_release(&textcache_lock);
+	return false;
+}
+
+void
+textcache_purge(struct vnode *v)
+{
+	struct textcache_entry *te, **tep, *dead;
+	unsigned i;
+
+	dead = NULL;
+	spinlock_acquire(&textcache_lock);
+	for (i = 0; i < TEXTCACHE_BUCKETS; i++) {
+		tep = &textcache[i];
+		while (*tep != NULL) {
+			te = *tep;
+			if (te->te_vnode == v) {
+				*tep = te->te_next;
+				te->te_next = dead;
+				dead = te;
+			}
+			else {
+				tep = &te->te_next;
+			}
+		}
+	}
+	spinlock_release(&textcache_lock);
+
+	/* Processes still using the frames keep them until they exit. */
+	while (dead != NULL) {
+		te = dead;
+		dead = te->te_next;
+		coremap_free(te->te_frame);
+		kfree(te);
+	}
+}
@@ -0,0 +1,1297 @@
+/*
+ * Demand-paged virtual memory.
+ *
+ * Nothing in a user address space has memory behind it until it is
+ * touched. The first fault on a page allocates a frame, fills it
+ * (zeros, or the file contents for the parts of an ELF segment that
+ * come from the executable), enters it in the page table, and loads
+ * the TLB. Later TLB misses on the same page just reload the TLB from
+ * the page table.
+ *
+ * Pages shared by as_copy are mapped read-only until written; the
+ * write faults (VM_FAULT_READONLY if the page was already in the TLB)
+ * and the page is copied then.
+ *
+ * When memory runs out, pages are evicted to swap (see swap.h),
+ * chosen by the clock algorithm in coremap_clock. Eviction doesn't
+ * take the victim address space's lock; instead the victim's PTE is
+ * marked PTE_BUSY while the page is written out, and anyone else who
+ * wants to use or change a busy PTE waits for it. All changes to a
+ * resident page's PTE, and every TLB load, happen under vm_pagelock
+ * so that they can't slip in between marking a page busy and
+ * shooting down its TLB entries.
+ *
+ * Shared (copy-on-write) pages aren't evicted while they are shared
+ * (see vm_dropframe), but a page out in swap when the process forks
+ * shares its swap slot instead of being read back in.
+ *
+ * Pages of a program's read-only segments are shared between all the
+ * processes running it, through the text cache (see textcache.h):
+ * a fault on one maps the frame already there if there is one, and
+ * otherwise reads the page and offers its frame to the cache. These
+ * frames are shared too, so they aren't evicted either; when memory
+ * runs out, cached frames no process maps any more are given back
+ * before anything goes to swap.
+ *
+ * Pages of shared file mappings (mmap with MAP_SHARED) start out
+ * PTE_CLEAN and mapped read-only, so the first write faults and marks
+ * them dirty; vm_writeback writes dirty ones back to the file and
+ * makes them clean again. A mapped page that gets evicted goes to
+ * swap like any other and counts as dirty when it comes back. Fork
+ * shares a shared mapping's pages outright, without copy-on-write,
+ * through a page object the copies have in common (see vm_object
+ * below), so parent and child see each other's stores, including to
+ * pages neither had touched at the time; each PTE keeps its own clean
+ * bit, so whichever side dirtied a page writes it back.
+ *
+ * Most TLB misses are for pages that are resident and just fell out
+ * of the TLB. vm_tlbrefill handles those without the address space
+ * lock or the region list, using the PTE_WRITE bit recorded in the
+ * PTE, and only falls back to the full fault path when there is real
+ * work to do.
+ *
+ * The MIPS TLB only maps 4K pages, and has no page size mask to make
+ * an entry cover more. Instead, a refill treats each aligned group of
+ * VM_BLOCKPAGES pages as one large page and loads the TLB for all of
+ * the group's resident pages at once, so a program running through a
+ * big array takes one miss per group rather than one per page.
+ *
+ * Page faults get the same treatment: when a page is touched for the
+ * first time, the fault handler also maps the pages after it that
+ * are resident or only need zeroing (see vm_faultaround), over a
+ * window that grows while the faults keep coming in order.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <textcache.h>
+#include <kmem_cache.h>
+
+/*
+ * Protects the PTE_BUSY bits and the PTEs of resident pages, the
+ * coremap's record of which PTE maps each pageable page, and the
+ * sharer lists below. Threads waiting for a busy page sleep on
+ * vm_pagewchan.
+ */
+static struct spinlock vm_pagelock = SPINLOCK_INITIALIZER;
+static struct wchan *vm_pagewchan;
+
+/*
+ * A frame shared between PTEs by fork (see vm_copypage) can't be
+ * paged out, since eviction can only fix up one PTE. So that it can
+ * be once all but one of them have let it go, each PTE sharing a
+ * frame gets one of these, hashed on the frame; when only one is
+ * left, the list goes away and the frame is made pageable again for
+ * that PTE (see vm_dropframe). Frames shared through the text cache
+ * aren't listed, since the cache holds a reference of its own.
+ */
+struct vm_sharer {
+	struct vm_sharer *vs_next;
+	paddr_t vs_frame;
+	pte_t *vs_pte;
+};
+
+#define VM_SHARERBUCKETS	64
+#define VM_SHARERHASH(pa)	(((pa) / PAGE_SIZE) % VM_SHARERBUCKETS)
+static struct vm_sharer *vm_sharers[VM_SHARERBUCKETS];
+
+/*
+ * The pages of a shared mapping, once a fork has shared it between
+ * address spaces. Until then its pages are the process's own like
+ * any others. From the fork on, every page of the mapping anyone has
+ * touched is also held here, so that a page one side brings in later
+ * is found by the other: vo_pages has a PTE for each page from
+ * vr_filevaddr up, holding a reference to the page's frame, or its
+ * swap slot once nobody maps it and it has been paged out. A frame
+ * the object shares with processes isn't paged out, but one only the
+ * object still holds is, through its entry here (see vm_dropframe).
+ *
+ * vo_lock is held while looking at or filling in an entry, and covers
+ * vo_refcount, the number of regions using the object. Entries of
+ * resident pages also follow the vm_pagelock rules, like any PTE.
+ */
+struct vm_object {
+	struct lock *vo_lock;
+	unsigned vo_refcount;
+	size_t vo_npages;
+	pte_t *vo_pages;
+};
+
+/* Pages per emulated large page; a power of 2. */
+#define VM_BLOCKPAGES	4
+
+/*
+ * Largest fault-around window, in pages, and the number of free pages
+ * below which fault-around is skipped.
+ */
+#define VM_FAULTAROUND_MAX	8
+#define VM_FAULTAROUND_MINFREE	64
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	vm_pagewchan = wchan_create("vmpage");
+	if (vm_pagewchan == NULL) {
+		panic("vm: Could not create page wchan\n");
+	}
+	swap_bootstrap();
+}
+
+/*
+ * Wait until *PTE isn't busy. Call with vm_pagelock held.
+ */
+static
+void
+vm_waitpage(pte_t *pte)
+{
+	while (*pte & PTE_BUSY) {
+		wchan_sleep(vm_pagewchan, &vm_pagelock);
+	}
+}
+
+/*
+ * Make the frame PA the resident page for *PTE. FLAGS is PTE_WRITE
+ * or 0.
+ */
+static
+void
+vm_setpage(pte_t *pte, paddr_t pa, pte_t flags, bool pageable)
+{
+	spinlock_acquire(&vm_pagelock);
+	*pte = pa | PTE_VALID | flags;
+	coremap_setpte(pa, pageable ? pte : NULL);
+	spinlock_release(&vm_pagelock);
+}
+
+/*
+ * Get two sharer records for vm_shareframe, in SPARES. Returns ENOMEM
+ * if there's no memory for them.
+ */
+static
+int
+vm_getsharers(struct vm_sharer **spares)
+{
+	spares[0] = kmalloc(sizeof(*spares[0]));
+	spares[1] = kmalloc(sizeof(*spares[1]));
+	if (spares[0] == NULL || spares[1] == NULL) {
+		kfree(spares[0]);
+		kfree(spares[1]);
+		return ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Free a list of sharer records.
+ */
+static
+void
+vm_freesharers(struct vm_sharer *vs)
+{
+	struct vm_sharer *next;
+
+	for (; vs != NULL; vs = next) {
+		next = vs->vs_next;
+		kfree(vs);
+	}
+}
+
+/*
+ * List *PTE as a sharer of the frame PA, using the record in *SPARE.
+ */
+static
+void
+vm_addsharer(paddr_t pa, pte_t *pte, struct vm_sharer **spare)
+{
+	struct vm_sharer *vs;
+	unsigned bucket;
+
+	vs = *spare;
+	*spare = NULL;
+	KASSERT(vs != NULL);
+	vs->vs_frame = pa;
+	vs->vs_pte = pte;
+	bucket = VM_SHARERHASH(pa);
+	vs->vs_next = vm_sharers[bucket];
+	vm_sharers[bucket] = vs;
+}
+
+/*
+ * Add a reference to the frame in *OLDPTE for *NEWPTE, which the
+ * caller then points at it. The frame stops being pageable. SPARES
+ * holds two records from vm_getsharers; those used are set to NULL,
+ * and the caller frees the rest. Call with vm_pagelock held.
+ */
+static
+void
+vm_shareframe(pte_t *oldpte, pte_t *newpte, struct vm_sharer **spares)
+{
+	struct vm_sharer *vs;
+	paddr_t pa;
+	bool listed;
+
+	KASSERT(*oldpte & PTE_VALID);
+	pa = *oldpte & PTE_FRAME;
+
+	listed = false;
+	for (vs = vm_sharers[VM_SHARERHASH(pa)]; vs != NULL;
+	     vs = vs->vs_next) {
+		if (vs->vs_frame == pa) {
+			listed = true;
+			break;
+		}
+	}
+	if (!listed && coremap_getref(pa) == 1) {
+		/* Private to *OLDPTE until now. */
+		vm_addsharer(pa, oldpte, &spares[0]);
+		listed = true;
+	}
+	if (listed) {
+		vm_addsharer(pa, newpte, &spares[1]);
+	}
+
+	coremap_incref(pa);
+	coremap_setpte(pa, NULL);
+}
+
+/*
+ * Drop *PTE's reference to its frame. If that leaves a single PTE
+ * sharing it, make the frame pageable again for that PTE. Call with
+ * vm_pagelock held; returns the sharer records no longer needed, to
+ * be freed with vm_freesharers after releasing it.
+ */
+static
+struct vm_sharer *
+vm_dropframe(pte_t *pte)
+{
+	struct vm_sharer *vs, **vsp, **lastp, *dead;
+	paddr_t pa;
+	unsigned n;
+
+	KASSERT(*pte & PTE_VALID);
+	pa = *pte & PTE_FRAME;
+
+	dead = NULL;
+	lastp = NULL;
+	n = 0;
+	vsp = &vm_sharers[VM_SHARERHASH(pa)];
+	while ((vs = *vsp) != NULL) {
+		if (vs->vs_frame != pa) {
+			vsp = &vs->vs_next;
+			continue;
+		}
+		if (vs->vs_pte == pte) {
+			*vsp = vs->vs_next;
+			vs->vs_next = dead;
+			dead = vs;
+			continue;
+		}
+		n++;
+		lastp = vsp;
+		vsp = &vs->vs_next;
+	}
+
+	coremap_free(pa);
+	if (n == 1) {
+		vs = *lastp;
+		*lastp = vs->vs_next;
+		KASSERT(coremap_getref(pa) == 1);
+		coremap_setpte(pa, vs->vs_pte);
+		vs->vs_next = dead;
+		dead = vs;
+	}
+	return dead;
+}
+
+/*
+ * Push one page out to swap to free its frame.
+ */
+static
+int
+vm_evict(void)
+{
+	paddr_t pa;
+	pte_t *pte;
+	unsigned slot;
+	int result;
+
+	result = swap_alloc(&slot);
+	if (result) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&vm_pagelock);
+	pa = coremap_clock(&pte);
+	if (pa == 0) {
+		spinlock_release(&vm_pagelock);
+		swap_free(slot);
+		return ENOMEM;
+	}
+	KASSERT((*pte & (PTE_VALID | PTE_BUSY)) == PTE_VALID);
+	KASSERT((*pte & PTE_FRAME) == pa);
+	*pte |= PTE_BUSY;
+	spinlock_release(&vm_pagelock);
+
+	/* Nobody can load it into a TLB now; get it out of them all. */
+	vm_tlb_shootdown_all();
+
+	result = swap_out(pa, slot);
+
+	spinlock_acquire(&vm_pagelock);
+	if (result) {
+		*pte &= ~(pte_t)PTE_BUSY;
+	}
+	else {
+		*pte = PTE_MKSLOT(slot) | PTE_SWAPPED | (*pte & PTE_WRITE);
+		coremap_free(pa);
+	}
+	wchan_wakeall(vm_pagewchan, &vm_pagelock);
+	spinlock_release(&vm_pagelock);
+
+	if (result) {
+		swap_free(slot);
+	}
+	return result;
+}
+
+/*
+ * Free a frame: drop a text cache page nobody maps if there is one,
+ * or the kernel's cached objects, otherwise evict a user page. For
+ * vm_getframe and for kernel allocations (see alloc_kpages).
+ */
+bool
+vm_reclaimpage(void)
+{
+	return textcache_reclaim() || kmem_cache_reclaim() ||
+		vm_evict() == 0;
+}
+
+/*
+ * Get a frame for user memory, zeroed if ZERO is set, dropping an
+ * unused text cache page or evicting a page if memory is full.
+ * Returns 0 if that's impossible.
+ */
+static
+paddr_t
+vm_getframe(bool zero)
+{
+	paddr_t pa;
+
+	while ((pa = zero ? coremap_alloc_zeroed() : coremap_alloc(1)) == 0) {
+		if (!vm_reclaimpage()) {
+			return 0;
+		}
+	}
+	return pa;
+}
+
+/*
+ * Whether the page at VADDR in region VR can go in the text cache:
+ * it is read-only program text or data, and all of it comes from
+ * the file.
+ */
+static
+bool
+vm_pagesharable(struct vm_region *vr, vaddr_t vaddr)
+{
+	return vr->vr_vnode != NULL && !vr->vr_writeable &&
+		!vr->vr_mapped &&
+		vaddr >= vr->vr_filevaddr &&
+		vaddr + PAGE_SIZE <= vr->vr_filevaddr + vr->vr_filesize;
+}
+
+/*
+ * If the page at VADDR in region VR is in the text cache, map the
+ * cached frame in *PTE and return true.
+ */
+static
+bool
+vm_pageshared(struct vm_region *vr, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t pa;
+
+	if (!vm_pagesharable(vr, vaddr)) {
+		return false;
+	}
+	pa = textcache_lookup(vr->vr_vnode,
+			      vr->vr_fileoffset + (vaddr - vr->vr_filevaddr));
+	if (pa == 0) {
+		return false;
+	}
+	vm_setpage(pte, pa, 0, false);
+	return true;
+}
+
+/*
+ * The PTE flags a newly paged-in page of region VR starts out with.
+ */
+static
+pte_t
+vm_pageflags(struct vm_region *vr)
+{
+	pte_t flags;
+
+	flags = vr->vr_writeable ? PTE_WRITE : 0;
+	if (vr->vr_shared) {
+		flags |= PTE_CLEAN;
+	}
+	return flags;
+}
+
+/*
+ * Give the page at VADDR in region VR a frame and its initial
+ * contents, and record it in *PTE. Read-only program pages come
+ * from, or go into, the text cache.
+ */
+static
+int
+vm_pagein(struct vm_region *vr, vaddr_t vaddr, pte_t *pte)
+{
+	struct iovec iov;
+	struct uio ku;
+	paddr_t pa;
+	vaddr_t kva, start, end;
+	unsigned version = 0;
+	bool sharable;
+	int result;
+
+	if (vm_pageshared(vr, vaddr, pte)) {
+		return 0;
+	}
+	sharable = vm_pagesharable(vr, vaddr);
+	if (sharable) {
+		/* Before reading, in case the file changes meanwhile. */
+		version = vr->vr_vnode->vn_version;
+	}
+
+	pa = vm_getframe(true);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	kva = PADDR_TO_KVADDR(pa);
+
+	if (vr->vr_vnode != NULL) {
+		/* The part of this page that comes from the file, if any */
+		start = vaddr > vr->vr_filevaddr ? vaddr : vr->vr_filevaddr;
+		end = vr->vr_filevaddr + vr->vr_filesize;
+		if (end > vaddr + PAGE_SIZE) {
+			end = vaddr + PAGE_SIZE;
+		}
+		if (start < end) {
+			uio_kinit(&iov, &ku, (void *)(kva + (start - vaddr)),
+				  end - start,
+				  vr->vr_fileoffset +
+				  (start - vr->vr_filevaddr),
+				  UIO_READ);
+			result = VOP_READ(vr->vr_vnode, &ku);
+			if (result == 0 && ku.uio_resid != 0) {
+				kprintf("vm: short read paging in 0x%lx - "
+					"file truncated?\n",
+					(unsigned long)vaddr);
+				result = EIO;
+			}
+			if (result) {
+				coremap_free(pa);
+				return result;
+			}
+		}
+	}
+
+	if (sharable && textcache_insert(vr->vr_vnode, version,
+					 vr->vr_fileoffset +
+					 (vaddr - vr->vr_filevaddr), &pa)) {
+		vm_setpage(pte, pa, 0, false);
+		return 0;
+	}
+
+	vm_setpage(pte, pa, vm_pageflags(vr), true);
+	return 0;
+}
+
+/*
+ * Bring the swapped-out page in *PTE, which the caller owns (it holds
+ * the address space lock, or the object's lock for an object's page),
+ * back into a frame of its own, and drop
+ * its reference to the swap slot (which other PTEs may share; see
+ * vm_copypage).
+ */
+static
+int
+vm_swapin(pte_t *pte)
+{
+	paddr_t pa;
+	unsigned slot;
+	int result;
+
+	KASSERT(*pte & PTE_SWAPPED);
+	slot = PTE_SLOT(*pte);
+
+	pa = vm_getframe(false);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	result = swap_in(pa, slot);
+	if (result) {
+		coremap_free(pa);
+		return result;
+	}
+	swap_free(slot);
+	vm_setpage(pte, pa, *pte & PTE_WRITE, true);
+	return 0;
+}
+
+/*
+ * Make the copy-on-write page in *PTE private so it can be written:
+ * if nobody else has the frame any more, just take it over,
+ * otherwise copy it and drop our reference to the shared one.
+ *
+ * If two address spaces sharing a frame get here at once, both may
+ * copy it; that is wasteful but harmless, since nobody writes the
+ * shared frame while it has more than one reference.
+ */
+static
+int
+vm_unshare(pte_t *pte)
+{
+	struct vm_sharer *dead;
+	paddr_t oldpa, pa;
+
+	oldpa = *pte & PTE_FRAME;
+	if (coremap_getref(oldpa) == 1) {
+		vm_setpage(pte, oldpa, PTE_WRITE, true);
+		return 0;
+	}
+
+	pa = vm_getframe(false);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(pa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+
+	spinlock_acquire(&vm_pagelock);
+	dead = vm_dropframe(pte);
+	*pte = pa | PTE_VALID | PTE_WRITE;
+	coremap_setpte(pa, pte);
+	spinlock_release(&vm_pagelock);
+
+	vm_freesharers(dead);
+	return 0;
+}
+
+/*
+ * Release whatever *PTE holds (a frame reference or a swap slot) and
+ * clear it. For as_destroy and friends; the caller holds the address
+ * space lock.
+ */
+void
+vm_freepage(pte_t *pte)
+{
+	struct vm_sharer *dead;
+
+	dead = NULL;
+	spinlock_acquire(&vm_pagelock);
+	vm_waitpage(pte);
+	if (*pte & PTE_VALID) {
+		dead = vm_dropframe(pte);
+	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(*pte));
+	}
+	*pte = 0;
+	spinlock_release(&vm_pagelock);
+
+	vm_freesharers(dead);
+}
+
+/*
+ * Write the page at VADDR in the shared mapping VR, whose PTE is
+ * *PTE, back to the file if it's dirty. The caller owns *PTE, as for
+ * vm_swapin. If AS is set, *PTE is its page table entry, and its TLB
+ * entries are dropped so the next write marks the page dirty again.
+ * The page is busy during the write, so nothing evicts or changes it
+ * meanwhile.
+ */
+static
+int
+vm_writepage(struct addrspace *as, struct vm_region *vr, vaddr_t vaddr,
+	     pte_t *pte)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t end;
+	paddr_t pa;
+	int result;
+
+	KASSERT(vr->vr_shared && vr->vr_vnode != NULL);
+	KASSERT(vaddr >= vr->vr_filevaddr);
+
+	spinlock_acquire(&vm_pagelock);
+	vm_waitpage(pte);
+	while (*pte & PTE_SWAPPED) {
+		/* Written and then evicted; bring it back to write it. */
+		spinlock_release(&vm_pagelock);
+		result = vm_swapin(pte);
+		if (result) {
+			return result;
+		}
+		spinlock_acquire(&vm_pagelock);
+		vm_waitpage(pte);
+	}
+	if (!(*pte & PTE_VALID) || (*pte & PTE_CLEAN)) {
+		spinlock_release(&vm_pagelock);
+		return 0;
+	}
+	*pte |= PTE_BUSY | PTE_CLEAN;
+	pa = *pte & PTE_FRAME;
+	spinlock_release(&vm_pagelock);
+
+	if (as != NULL) {
+		/* Make the next write fault again, to mark it dirty. */
+		vm_tlb_shootdown(as, vaddr, 1);
+	}
+
+	/* Only the part that is in the file goes back. */
+	end = vr->vr_filevaddr + vr->vr_filesize;
+	if (end > vaddr + PAGE_SIZE) {
+		end = vaddr + PAGE_SIZE;
+	}
+	result = 0;
+	if (vaddr < end) {
+		uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa),
+			  end - vaddr,
+			  vr->vr_fileoffset + (vaddr - vr->vr_filevaddr),
+			  UIO_WRITE);
+		result = VOP_WRITE(vr->vr_vnode, &ku);
+	}
+
+	spinlock_acquire(&vm_pagelock);
+	*pte &= ~(pte_t)PTE_BUSY;
+	if (result) {
+		*pte &= ~(pte_t)PTE_CLEAN;
+	}
+	wchan_wakeall(vm_pagewchan, &vm_pagelock);
+	spinlock_release(&vm_pagelock);
+	return result;
+}
+
+/*
+ * Find the object's entry for the page at VADDR of region VR.
+ */
+static
+pte_t *
+vm_objpage(struct vm_region *vr, vaddr_t vaddr)
+{
+	size_t i;
+
+	KASSERT(vaddr >= vr->vr_filevaddr);
+	i = (vaddr - vr->vr_filevaddr) / PAGE_SIZE;
+	KASSERT(i < vr->vr_object->vo_npages);
+	return &vr->vr_object->vo_pages[i];
+}
+
+/*
+ * Write the page at VADDR in the shared mapping VR of AS, whose PTE
+ * is *PTE (or NULL, if there's no page table page for it), back to
+ * the file if it's dirty. If AS doesn't have the page but the
+ * mapping's object does, that copy is written instead. The caller
+ * holds the address space lock.
+ */
+int
+vm_writeback(struct addrspace *as, struct vm_region *vr, vaddr_t vaddr,
+	     pte_t *pte)
+{
+	struct vm_object *obj;
+	int result;
+
+	if (pte != NULL && *pte != 0) {
+		return vm_writepage(as, vr, vaddr, pte);
+	}
+	obj = vr->vr_object;
+	if (obj == NULL) {
+		return 0;
+	}
+	lock_acquire(obj->vo_lock);
+	result = vm_writepage(NULL, vr, vaddr, vm_objpage(vr, vaddr));
+	lock_release(obj->vo_lock);
+	return result;
+}
+
+/*
+ * Give *NEWPTE the same contents as *OLDPTE, for as_copy. A resident
+ * page is shared, and marked copy-on-write if COW is set; a swapped
+ * page shares the swap slot, and whichever side touches it first
+ * reads it back into a frame of its own. The caller holds the old
+ * address space's lock; nobody else can see the new one yet.
+ */
+int
+vm_copypage(pte_t *oldpte, pte_t *newpte, bool cow)
+{
+	struct vm_sharer *spares[2];
+	int result;
+
+	result = vm_getsharers(spares);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&vm_pagelock);
+	vm_waitpage(oldpte);
+	if (*oldpte & PTE_VALID) {
+		if (cow) {
+			*oldpte |= PTE_COW;
+		}
+		vm_shareframe(oldpte, newpte, spares);
+		*newpte = *oldpte;
+	}
+	else if (*oldpte & PTE_SWAPPED) {
+		swap_incref(PTE_SLOT(*oldpte));
+		*newpte = *oldpte;
+	}
+	spinlock_release(&vm_pagelock);
+
+	kfree(spares[0]);
+	kfree(spares[1]);
+	return 0;
+}
+
+/*
+ * Give shared mapping VR of address space AS a page object, holding
+ * the pages it has now, for vm_shareregion. A resident page is shared
+ * with the object; one out in swap is handed over to it, so that
+ * whichever side touches it first brings it in for both. The caller
+ * holds the address space lock.
+ */
+static
+int
+vm_object_create(struct addrspace *as, struct vm_region *vr)
+{
+	struct vm_object *obj;
+	struct vm_sharer *spares[2];
+	vaddr_t va, top;
+	pte_t *pte, *page;
+	size_t i;
+	int result;
+
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	KASSERT(vr->vr_filevaddr <= vr->vr_base);
+
+	obj = kmalloc(sizeof(*obj));
+	if (obj == NULL) {
+		return ENOMEM;
+	}
+	obj->vo_npages = (top - vr->vr_filevaddr) / PAGE_SIZE;
+	obj->vo_pages = kmalloc(obj->vo_npages * sizeof(pte_t));
+	if (obj->vo_pages == NULL) {
+		kfree(obj);
+		return ENOMEM;
+	}
+	obj->vo_lock = lock_create("vmobject");
+	if (obj->vo_lock == NULL) {
+		kfree(obj->vo_pages);
+		kfree(obj);
+		return ENOMEM;
+	}
+	obj->vo_refcount = 1;
+	for (i = 0; i < obj->vo_npages; i++) {
+		obj->vo_pages[i] = 0;
+	}
+	vr->vr_object = obj;
+
+	for (va = vr->vr_base; va < top; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || *pte == 0) {
+			continue;
+		}
+		result = vm_getsharers(spares);
+		if (result) {
+			goto fail;
+		}
+		page = vm_objpage(vr, va);
+
+		spinlock_acquire(&vm_pagelock);
+		vm_waitpage(pte);
+		if (*pte & PTE_VALID) {
+			vm_shareframe(pte, page, spares);
+			*page = *pte;
+		}
+		else if (*pte & PTE_SWAPPED) {
+			*page = *pte;
+			*pte = 0;
+		}
+		spinlock_release(&vm_pagelock);
+
+		kfree(spares[0]);
+		kfree(spares[1]);
+	}
+	return 0;
+
+ fail:
+	/* Give the process back what it had. */
+	for (va = vr->vr_base; va < top; va += PAGE_SIZE) {
+		page = vm_objpage(vr, va);
+		if (*page & PTE_SWAPPED) {
+			pte = pt_lookup(as->as_pt, va, false);
+			KASSERT(pte != NULL && *pte == 0);
+			*pte = *page;
+			*page = 0;
+		}
+		else if (*page != 0) {
+			vm_freepage(page);
+		}
+	}
+	vr->vr_object = NULL;
+	lock_destroy(obj->vo_lock);
+	kfree(obj->vo_pages);
+	kfree(obj);
+	return result;
+}
+
+/*
+ * Add a region to those using page object OBJ.
+ */
+void
+vm_object_incref(struct vm_object *obj)
+{
+	lock_acquire(obj->vo_lock);
+	obj->vo_refcount++;
+	lock_release(obj->vo_lock);
+}
+
+/*
+ * Drop a region's use of page object OBJ, freeing it and its pages
+ * when the last one goes. The regions write their pages back as they
+ * go away, so there's nothing left to save.
+ */
+void
+vm_object_decref(struct vm_object *obj)
+{
+	size_t i;
+	bool destroy;
+
+	lock_acquire(obj->vo_lock);
+	KASSERT(obj->vo_refcount > 0);
+	obj->vo_refcount--;
+	destroy = obj->vo_refcount == 0;
+	lock_release(obj->vo_lock);
+
+	if (destroy) {
+		for (i = 0; i < obj->vo_npages; i++) {
+			if (obj->vo_pages[i] != 0) {
+				vm_freepage(&obj->vo_pages[i]);
+			}
+		}
+		lock_destroy(obj->vo_lock);
+		kfree(obj->vo_pages);
+		kfree(obj);
+	}
+}
+
+/*
+ * Share shared mapping VR of address space OLD with NEWVR, its copy
+ * in NEWAS, for as_copy: both use the same page object from now on,
+ * and NEWAS maps the pages OLD has resident, sharing their frames
+ * without copy-on-write. Nothing is read in; the rest of the pages
+ * are found through the object when they're touched. The caller
+ * holds OLD's lock; nobody else can see NEWAS yet.
+ */
+int
+vm_shareregion(struct addrspace *old, struct vm_region *vr,
+	       struct addrspace *newas, struct vm_region *newvr)
+{
+	vaddr_t va, top;
+	pte_t *oldpte, *newpte;
+	int result;
+
+	KASSERT(vr->vr_shared);
+
+	if (vr->vr_object == NULL) {
+		result = vm_object_create(old, vr);
+		if (result) {
+			return result;
+		}
+	}
+	vm_object_incref(vr->vr_object);
+	newvr->vr_object = vr->vr_object;
+
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	for (va = vr->vr_base; va < top; va += PAGE_SIZE) {
+		oldpte = pt_lookup(old->as_pt, va, false);
+		if (oldpte == NULL || *oldpte == 0) {
+			continue;
+		}
+		newpte = pt_lookup(newas->as_pt, va, true);
+		if (newpte == NULL) {
+			return ENOMEM;
+		}
+		result = vm_copypage(oldpte, newpte, false);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Map the page at VADDR of region VR, which has a page object, in
+ * *PTE: find it in the object, bringing it in first if nobody has
+ * it, and share its frame. The caller holds the address space lock.
+ */
+static
+int
+vm_objpagein(struct vm_region *vr, vaddr_t vaddr, pte_t *pte)
+{
+	struct vm_object *obj;
+	struct vm_sharer *spares[2];
+	pte_t *page, flags;
+	int result;
+
+	result = vm_getsharers(spares);
+	if (result) {
+		return result;
+	}
+
+	obj = vr->vr_object;
+	page = vm_objpage(vr, vaddr);
+	lock_acquire(obj->vo_lock);
+	while (1) {
+		if (*page & PTE_SWAPPED) {
+			result = vm_swapin(page);
+		}
+		else if (!(*page & PTE_VALID)) {
+			result = vm_pagein(vr, vaddr, page);
+		}
+		else {
+			result = 0;
+		}
+		if (result) {
+			break;
+		}
+
+		spinlock_acquire(&vm_pagelock);
+		vm_waitpage(page);
+		if (*page & PTE_VALID) {
+			/* Dirty in the object means dirty here too. */
+			flags = vm_pageflags(vr);
+			if (!(*page & PTE_CLEAN)) {
+				flags &= ~(pte_t)PTE_CLEAN;
+			}
+			vm_shareframe(page, pte, spares);
+			*pte = (*page & PTE_FRAME) | PTE_VALID | flags;
+			spinlock_release(&vm_pagelock);
+			break;
+		}
+		/* Evicted before we got it; again. */
+		spinlock_release(&vm_pagelock);
+	}
+	lock_release(obj->vo_lock);
+
+	kfree(spares[0]);
+	kfree(spares[1]);
+	return result;
+}
+
+/*
+ * Whether the TLB entry for a page with PTE P should allow writes.
+ */
+static
+bool
+vm_pte_writeable(pte_t p)
+{
+	return (p & PTE_WRITE) && !(p & (PTE_COW | PTE_CLEAN));
+}
+
+/*
+ * TLB refill fast path: if the page is resident and the access is
+ * allowed, load the TLB and return true. Anything else (first touch,
+ * swapped out, copy-on-write, bad address) returns false for
+ * vm_fault's slow path to sort out.
+ *
+ * The address space lock isn't needed: only the process's own thread
+ * (which is us) changes its page table structure, and vm_pagelock
+ * covers the PTE against eviction.
+ *
+ * The other resident pages in VADDR's group get loaded too. They are
+ * marked referenced along with it, since the clock would otherwise
+ * not see them used until they missed on their own.
+ */
+static
+bool
+vm_tlbrefill(struct addrspace *as, int faulttype, vaddr_t vaddr)
+{
+	pte_t *pte, *block, p;
+	vaddr_t base;
+	unsigned i;
+	bool done;
+
+	if (faulttype == VM_FAULT_READONLY) {
+		/* Write to a page loaded read-only: copy-on-write */
+		return false;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte == NULL) {
+		return false;
+	}
+
+	done = false;
+	spinlock_acquire(&vm_pagelock);
+	p = *pte;
+	if ((p & (PTE_VALID | PTE_BUSY)) == PTE_VALID &&
+	    (faulttype == VM_FAULT_READ || vm_pte_writeable(p))) {
+		vm_tlb_load(vaddr, p & PTE_FRAME, vm_pte_writeable(p));
+		coremap_touch(p & PTE_FRAME);
+		done = true;
+	}
+	if (done) {
+		/* A group never straddles two page table pages. */
+		base = vaddr & ~(vaddr_t)(VM_BLOCKPAGES * PAGE_SIZE - 1);
+		block = pte - (vaddr - base) / PAGE_SIZE;
+		for (i = 0; i < VM_BLOCKPAGES; i++) {
+			p = block[i];
+			if (&block[i] == pte ||
+			    (p & (PTE_VALID | PTE_BUSY)) != PTE_VALID) {
+				continue;
+			}
+			vm_tlb_load(base + i * PAGE_SIZE, p & PTE_FRAME,
+				    vm_pte_writeable(p));
+			coremap_touch(p & PTE_FRAME);
+		}
+	}
+	spinlock_release(&vm_pagelock);
+	return done;
+}
+
+/*
+ * Whether the page at VADDR in region VR starts out all zeros, with
+ * nothing to read from the file.
+ */
+static
+bool
+vm_zerofill(struct vm_region *vr, vaddr_t vaddr)
+{
+	return vr->vr_vnode == NULL ||
+		vaddr + PAGE_SIZE <= vr->vr_filevaddr ||
+		vaddr >= vr->vr_filevaddr + vr->vr_filesize;
+}
+
+/*
+ * Fault-around: after a first-touch fault on VADDR in region VR, map
+ * the next few pages too, as long as they are resident, zero-fill, or
+ * in the text cache; anything that needs I/O is left for its own
+ * fault. The window
+ * starts at nothing, and doubles (up to VM_FAULTAROUND_MAX) each time
+ * the next fault lands right after the last window, i.e. while the
+ * process is streaming through memory. Any other fault shrinks it
+ * back to nothing. Call with the address space lock held.
+ *
+ * These pages are only a guess, so they mustn't cost anyone else
+ * anything: zero-fill pages only take frames that are free or already
+ * zeroed, never ones that would have to be reclaimed or evicted, and
+ * nothing is done at all when free memory is low. Nor does the window
+ * reach into a page table page that doesn't exist yet.
+ */
+static
+void
+vm_faultaround(struct addrspace *as, struct vm_region *vr, vaddr_t vaddr)
+{
+	vaddr_t va, end;
+	paddr_t pa;
+	pte_t *pte;
+	unsigned win;
+	bool mapped;
+
+	if (vaddr != as->as_faultnext) {
+		win = 0;
+	}
+	else if (as->as_faultwin == 0) {
+		win = 1;
+	}
+	else {
+		win = as->as_faultwin * 2;
+		if (win > VM_FAULTAROUND_MAX) {
+			win = VM_FAULTAROUND_MAX;
+		}
+	}
+	as->as_faultwin = win;
+	if (win > 0 && coremap_nfreepages() < VM_FAULTAROUND_MINFREE) {
+		win = 0;
+	}
+
+	end = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	for (va = vaddr + PAGE_SIZE;
+	     va < end && va <= vaddr + win * PAGE_SIZE;
+	     va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			break;
+		}
+		if (*pte == 0) {
+			if (vr->vr_object != NULL) {
+				/* Shared with other processes; not a guess. */
+				break;
+			}
+			if (vm_zerofill(vr, va)) {
+				pa = coremap_alloc_zeroed();
+				if (pa == 0) {
+					break;
+				}
+				vm_setpage(pte, pa, vm_pageflags(vr), true);
+			}
+			else if (!vm_pageshared(vr, va, pte)) {
+				break;
+			}
+		}
+
+		spinlock_acquire(&vm_pagelock);
+		mapped = (*pte & (PTE_VALID | PTE_BUSY)) == PTE_VALID;
+		if (mapped) {
+			vm_tlb_load(va, *pte & PTE_FRAME,
+				    vm_pte_writeable(*pte));
+			coremap_touch(*pte & PTE_FRAME);
+		}
+		spinlock_release(&vm_pagelock);
+		if (!mapped) {
+			/* Swapped or being evicted; not worth waiting. */
+			break;
+		}
+	}
+	as->as_faultnext = va;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct vm_region *vr;
+	pte_t *pte;
+	bool firsttouch;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	/* Just a statistic; the process's only thread is us. */
+	curproc->p_tlbmisses++;
+
+	if (vm_tlbrefill(as, faulttype, faultaddress)) {
+		return 0;
+	}
+
+	curproc->p_pagefaults++;
+
+	lock_acquire(as->as_lock);
+
+	vr = as_findregion(as, faultaddress);
+	if (vr == NULL) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+	if (faulttype != VM_FAULT_READ && !vr->vr_writeable) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	firsttouch = *pte == 0;
+	while (1) {
+		/* Our own pages only change under us by being evicted. */
+		if (*pte & PTE_SWAPPED) {
+			result = vm_swapin(pte);
+		}
+		else if (!(*pte & PTE_VALID) && vr->vr_object != NULL) {
+			result = vm_objpagein(vr, faultaddress, pte);
+		}
+		else if (!(*pte & PTE_VALID)) {
+			result = vm_pagein(vr, faultaddress, pte);
+		}
+		else if ((*pte & PTE_COW) && faulttype != VM_FAULT_READ) {
+			result = vm_unshare(pte);
+			if (result == 0) {
+				/* Other CPUs may still map the old frame. */
+				vm_tlb_shootdown(as, faultaddress, 1);
+			}
+		}
+		else if ((*pte & PTE_CLEAN) && faulttype != VM_FAULT_READ) {
+			/* First write since the last write-back. */
+			spinlock_acquire(&vm_pagelock);
+			vm_waitpage(pte);
+			*pte &= ~(pte_t)PTE_CLEAN;
+			spinlock_release(&vm_pagelock);
+			result = 0;
+		}
+		else {
+			result = 0;
+		}
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+
+		spinlock_acquire(&vm_pagelock);
+		vm_waitpage(pte);
+		if (*pte & PTE_VALID) {
+			break;
+		}
+		/* It got evicted while we weren't looking; again. */
+		spinlock_release(&vm_pagelock);
+	}
+
+	vm_tlb_load(faultaddress, *pte & PTE_FRAME, vm_pte_writeable(*pte));
+	coremap_touch(*pte & PTE_FRAME);
+	spinlock_release(&vm_pagelock);
+
+	if (firsttouch) {
+		vm_faultaround(as, vr, faultaddress);
+	}
+
+	lock_release(as->as_lock);
+	return 0;
+}